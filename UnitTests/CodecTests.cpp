@@ -0,0 +1,176 @@
+//
+//  CodecTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "../libnrio/BlockCodec.h"
+#include "../libnrio/IndexedDataStore.h"
+
+#define CODEC_BLOCK_SIZE 4096
+
+namespace nrcore {
+
+    // Data with no repeats for the codec to find
+    static std::vector<char> noise(size_t length, unsigned int seed) {
+        std::vector<char> ret(length);
+        unsigned int state = seed*2654435761u+1;
+        for (size_t i=0; i<length; i++) {
+            state = state*1103515245u+12345u;
+            ret[i] = (char)(state >> 16);
+        }
+        return ret;
+    }
+
+    static std::vector<char> run(size_t length, char value) {
+        return std::vector<char>(length, value);
+    }
+
+    // Compressed and decompressed through buffers of exactly the size needed, so overruns are caught by the sanitizer
+    static bool roundTrip(const std::vector<char> &data) {
+        std::vector<char> packed(data.size()+data.size()/255+16);
+        size_t length = BlockCodec::compress(data.data(), data.size(), packed.data(), packed.size());
+        if (!length && data.size())
+            return false;
+        
+        std::vector<char> exact(packed.begin(), packed.begin()+length);
+        std::vector<char> out(data.size());
+        if (!BlockCodec::decompress(exact.data(), exact.size(), out.data(), out.size()))
+            return false;
+        return out == data;
+    }
+
+    static void testRoundTrips(UnitTest &test) {
+        bool ok = true;
+        for (size_t len=0; len<=13; len++) {
+            ok = ok && roundTrip(noise(len, (unsigned int)len));
+            ok = ok && roundTrip(run(len, 'a'));
+        }
+        TEST_ASSERT(ok);
+        
+        TEST_ASSERT(roundTrip(noise(CODEC_BLOCK_SIZE, 1)));
+        TEST_ASSERT(roundTrip(run(CODEC_BLOCK_SIZE, 0)));
+        
+        // Runs between stretches of noise, and matches longer than one length byte
+        std::vector<char> mixed = noise(CODEC_BLOCK_SIZE, 2);
+        memset(&mixed[100], 'x', 1000);
+        memcpy(&mixed[2000], &mixed[1500], 300);
+        TEST_ASSERT(roundTrip(mixed));
+        
+        // Runs compress, noise does not fit back into its own length
+        std::vector<char> packed(CODEC_BLOCK_SIZE);
+        std::vector<char> zeros = run(CODEC_BLOCK_SIZE, 0);
+        size_t length = BlockCodec::compress(zeros.data(), zeros.size(), packed.data(), packed.size());
+        TEST_ASSERT(length > 0 && length < 64);
+        
+        std::vector<char> random = noise(CODEC_BLOCK_SIZE, 3);
+        TEST_ASSERT(BlockCodec::compress(random.data(), random.size(), packed.data(), packed.size()) == 0);
+    }
+
+    static void testMalformedInput(UnitTest &test) {
+        std::vector<char> data = noise(CODEC_BLOCK_SIZE, 4);
+        memset(&data[1000], 'r', 2000);
+        
+        std::vector<char> packed(CODEC_BLOCK_SIZE*2);
+        size_t length = BlockCodec::compress(data.data(), data.size(), packed.data(), packed.size());
+        TEST_ASSERT(length > 0);
+        
+        // Every truncation is rejected
+        bool rejected = true;
+        for (size_t len=0; len<length; len++) {
+            std::vector<char> cut(packed.begin(), packed.begin()+len);
+            std::vector<char> out(data.size());
+            rejected = rejected && !BlockCodec::decompress(cut.data(), cut.size(), out.data(), out.size());
+        }
+        TEST_ASSERT(rejected);
+        
+        // Corrupt bytes may decode to other data but never outside the buffers
+        std::vector<char> out(data.size());
+        for (size_t i=0; i<length; i++) {
+            std::vector<char> corrupt(packed.begin(), packed.begin()+length);
+            corrupt[i] ^= 0x5A;
+            BlockCodec::decompress(corrupt.data(), corrupt.size(), out.data(), out.size());
+        }
+        
+        // A match reaching before the start of the output, one running past its end and a zero distance
+        const char before[] = {0x10, 'a', 0x05, 0x00};
+        const char past[] = {0x1F, 'a', 0x01, 0x00, 0x20};
+        const char zero[] = {0x10, 'a', 0x00, 0x00};
+        std::vector<char> small(10);
+        TEST_ASSERT(!BlockCodec::decompress(before, sizeof(before), small.data(), small.size()));
+        TEST_ASSERT(!BlockCodec::decompress(past, sizeof(past), small.data(), small.size()));
+        TEST_ASSERT(!BlockCodec::decompress(zero, sizeof(zero), small.data(), small.size()));
+        
+        // The stream is decoded up to the length asked for, trailing bytes are ignored
+        std::vector<char> runs = run(100, 'q');
+        length = BlockCodec::compress(runs.data(), runs.size(), packed.data(), packed.size());
+        packed[length] = 0x7F;
+        std::vector<char> decoded(runs.size());
+        TEST_ASSERT(BlockCodec::decompress(packed.data(), length+1, decoded.data(), decoded.size()));
+        TEST_ASSERT(decoded == runs);
+    }
+
+    static bool compressedFileMatches(IndexedDataStore &store, const std::vector<char> &expected) {
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(Memory("compressed", 10));
+        if (store.getFileSize(file) != expected.size())
+            return false;
+        
+        Memory data = store.readFromFile(file, 0, expected.size());
+        return data.length() == expected.size() && memcmp(data.operator char *(), expected.data(), expected.size()) == 0;
+    }
+
+    static void testMovedBlocks(UnitTest &test) {
+        std::string path = test.path("compressed.dat");
+        std::vector<char> expected = run(CODEC_BLOCK_SIZE*4, 'c');
+        
+        {
+            IndexedDataStore store(path.c_str());
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(Memory("compressed", 10), CODEC_BLOCK_SIZE, FILE_FLAG_COMPRESSED);
+            store.writeToFile(file, expected.data(), 0, expected.size());
+            TEST_ASSERT(compressedFileMatches(store, expected));
+            
+            // Noise no longer fits in the space of a compressed run, so the first, a middle and the last block move
+            std::vector<char> random = noise(CODEC_BLOCK_SIZE, 5);
+            unsigned int blocks[] = {0, 2, 3};
+            for (int i=0; i<3; i++) {
+                unsigned long long offset = blocks[i]*CODEC_BLOCK_SIZE+100;
+                store.writeToFile(file, random.data(), offset, 1000);
+                memcpy(&expected[offset], random.data(), 1000);
+                TEST_ASSERT(compressedFileMatches(store, expected));
+            }
+            
+            // And back to a run, the block shrinks into a new allocation again
+            std::vector<char> back = run(CODEC_BLOCK_SIZE, 'c');
+            store.writeToFile(file, back.data(), 2*CODEC_BLOCK_SIZE, CODEC_BLOCK_SIZE);
+            memcpy(&expected[2*CODEC_BLOCK_SIZE], back.data(), CODEC_BLOCK_SIZE);
+            TEST_ASSERT(compressedFileMatches(store, expected));
+            
+            // Appending after moves links the new block to the moved last block
+            store.writeToFile(file, random.data(), expected.size(), 500);
+            expected.insert(expected.end(), random.begin(), random.begin()+500);
+            TEST_ASSERT(compressedFileMatches(store, expected));
+        }
+        
+        IndexedDataStore store(path.c_str());
+        TEST_ASSERT(compressedFileMatches(store, expected));
+        
+        // Compaction walks the file again from its first block
+        store.compact();
+        TEST_ASSERT(compressedFileMatches(store, expected));
+    }
+
+    void testCodec(UnitTest &test) {
+        test.run("codec: round trips", testRoundTrips);
+        test.run("codec: malformed input", testMalformedInput);
+        test.run("codec: compressed blocks that move", testMovedBlocks);
+    }
+
+}
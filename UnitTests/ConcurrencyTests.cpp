@@ -0,0 +1,156 @@
+//
+//  ConcurrencyTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../libnrio/IndexedDataStore.h"
+
+#define READER_THREADS 4
+#define WRITE_ROUNDS 200
+#define SHARED_FILE_SIZE 16384
+
+namespace nrcore {
+
+    // Failed checks are counted on the test thread, the threads only report through these
+    typedef struct {
+        std::atomic<bool> done;
+        std::atomic<bool> torn;
+        std::atomic<int> reads;
+    } SHARED_STATE;
+
+    static void readShared(IndexedDataStore *store, SHARED_STATE *state) {
+        Memory file_key("shared", 6);
+        Array<Memory> keys;
+        keys.push(Memory("a", 1));
+        keys.push(Memory("b", 1));
+        
+        while (!state->done) {
+            // Every round rewrites the whole file with its own pattern, a read sees exactly one of them
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store->getFile(file_key);
+            Memory data = store->readFromFile(file, 0, SHARED_FILE_SIZE);
+            unsigned int seed = ((unsigned char)data.operator char *()[0] * 241) & 0xFF; // 241 is the inverse of 17
+            if (!UnitTest::matches(data.operator char *(), SHARED_FILE_SIZE, seed))
+                state->torn = true;
+            
+            // Both keys are set by one batch, readMany reads them under one lock
+            Array<Memory> values = store->readMany(keys, sizeof(int));
+            if (memcmp(values.get(0).operator char *(), values.get(1).operator char *(), sizeof(int)) != 0)
+                state->torn = true;
+            
+            state->reads++;
+        }
+    }
+
+    static void testReadersAlongsideWriter(UnitTest &test) {
+        IndexedDataStore store(test.path("shared.dat").c_str());
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(Memory("shared", 6), 512);
+        store.writeToFile(file, UnitTest::pattern(SHARED_FILE_SIZE, 0), 0, SHARED_FILE_SIZE);
+        store.set(Memory("a", 1), 0);
+        store.set(Memory("b", 1), 0);
+        
+        SHARED_STATE state;
+        state.done = false;
+        state.torn = false;
+        state.reads = 0;
+        
+        std::vector<std::thread> readers;
+        for (int i=0; i<READER_THREADS; i++)
+            readers.push_back(std::thread(readShared, &store, &state));
+        
+        for (int round=1; round<WRITE_ROUNDS; round++) {
+            store.writeToFile(file, UnitTest::pattern(SHARED_FILE_SIZE, round), 0, SHARED_FILE_SIZE);
+            
+            store.beginBatch();
+            store.set(Memory("a", 1), round);
+            usleep(100);
+            store.set(Memory("b", 1), round);
+            store.commit();
+        }
+        
+        state.done = true;
+        for (size_t i=0; i<readers.size(); i++)
+            readers[i].join();
+        
+        TEST_ASSERT(!state.torn);
+        TEST_ASSERT(state.reads > 0);
+        TEST_ASSERT(store.get<int>(Memory("b", 1)) == WRITE_ROUNDS-1);
+    }
+
+    static void testBatchExcludesReaders(UnitTest &test) {
+        IndexedDataStore store(test.path("exclusive.dat").c_str());
+        store.set(Memory("a", 1), 1);
+        
+        // The lock is taken by beginBatch and held until commit, a reader waits for the batch instead of seeing part of it
+        store.beginBatch();
+        store.set(Memory("a", 1), 2);
+        
+        std::atomic<int> seen(0);
+        std::thread reader([&store, &seen]() {
+            seen = store.get<int>(Memory("a", 1));
+        });
+        
+        usleep(100000);
+        TEST_ASSERT(seen == 0);
+        
+        store.commit();
+        reader.join();
+        TEST_ASSERT(seen == 2);
+    }
+
+    static void readKeys(IndexedDataStore *store, SHARED_STATE *state) {
+        while (!state->done) {
+            if (store->get<int>(Memory("a", 1)) != 1)
+                state->torn = true;
+            state->reads++;
+        }
+    }
+
+    static void testCacheCountersAlongsideReaders(UnitTest &test) {
+        IndexedDataStore store(test.path("counters.dat").c_str());
+        store.set(Memory("a", 1), 1);
+        
+        SHARED_STATE state;
+        state.done = false;
+        state.torn = false;
+        state.reads = 0;
+        
+        std::vector<std::thread> readers;
+        for (int i=0; i<READER_THREADS; i++)
+            readers.push_back(std::thread(readKeys, &store, &state));
+        
+        // Counters are read and the capacity changed while the readers update the cache
+        unsigned long long seen = 0;
+        for (int round=0; round<WRITE_ROUNDS; round++) {
+            seen += store.getCacheHits()+store.getCacheMisses();
+            store.setCacheSize(round%2 ? DESCRIPTOR_CACHE_SIZE : 16);
+            usleep(100);
+        }
+        
+        state.done = true;
+        for (size_t i=0; i<readers.size(); i++)
+            readers[i].join();
+        
+        TEST_ASSERT(!state.torn);
+        TEST_ASSERT(state.reads > 0);
+        TEST_ASSERT(seen > 0);
+    }
+
+    void testConcurrency(UnitTest &test) {
+        test.run("concurrency: readers alongside a writer", testReadersAlongsideWriter);
+        test.run("concurrency: a batch excludes readers", testBatchExcludesReaders);
+        test.run("concurrency: cache counters alongside readers", testCacheCountersAlongsideReaders);
+    }
+
+}
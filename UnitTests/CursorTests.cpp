@@ -0,0 +1,85 @@
+//
+//  CursorTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+
+#include "../libnrio/IndexedDataStore.h"
+
+namespace nrcore {
+
+    static void fillStore(IndexedDataStore &store, int count) {
+        char key[32];
+        for (int i=0; i<count; i++)
+            store.set(Memory(key, snprintf(key, sizeof(key), "scan/%04d", i)), i);
+    }
+
+    // True when next() reports the store as modified
+    static bool nextThrows(IndexedDataStore::Cursor &cursor) {
+        try {
+            cursor.next();
+            return false;
+        } catch (const char *e) {
+            return strcmp(e, "Store modified") == 0;
+        }
+    }
+
+    static void testCursorWalk(UnitTest &test) {
+        IndexedDataStore store(test.path("cursor.dat").c_str());
+        fillStore(store, 300);
+        
+        // Keys come back in order, reads alongside the walk leave it valid
+        IndexedDataStore::Cursor cursor = store.scan(Memory("scan/", 5));
+        int count = 0;
+        bool ordered = true;
+        while (cursor.next()) {
+            char key[32];
+            int len = snprintf(key, sizeof(key), "scan/%04d", count);
+            ordered = ordered && cursor.getKeyLength() == (size_t)len && memcmp(cursor.getKey(), key, len) == 0;
+            ordered = ordered && store.get<int>(Memory(key, len)) == count;
+            count++;
+        }
+        TEST_ASSERT(ordered);
+        TEST_ASSERT(count == 300);
+    }
+
+    static void testCursorInvalidatedByWrites(UnitTest &test) {
+        IndexedDataStore store(test.path("modified.dat").c_str());
+        fillStore(store, 300);
+        
+        IndexedDataStore::Cursor cursor = store.scan(Memory("scan/", 5));
+        TEST_ASSERT(cursor.next());
+        store.deleteFile(Memory("scan/0150", 9));
+        TEST_ASSERT(nextThrows(cursor));
+        
+        // A write inside a batch counts as well, and so does undoing it
+        IndexedDataStore::Cursor batched = store.scan(Memory("scan/", 5));
+        store.beginBatch();
+        store.set(Memory("scan/0150", 9), 150);
+        TEST_ASSERT(nextThrows(batched));
+        
+        IndexedDataStore::Cursor in_batch = store.scan(Memory("scan/", 5));
+        TEST_ASSERT(in_batch.next());
+        store.rollback();
+        TEST_ASSERT(nextThrows(in_batch));
+        
+        // A cursor started after the writes walks the store as it is now
+        IndexedDataStore::Cursor fresh = store.scan(Memory("scan/", 5));
+        int count = 0;
+        while (fresh.next())
+            count++;
+        TEST_ASSERT(count == 299);
+    }
+
+    void testCursor(UnitTest &test) {
+        test.run("cursor: keys in order", testCursorWalk);
+        test.run("cursor: invalidated by writes", testCursorInvalidatedByWrites);
+    }
+
+}
@@ -0,0 +1,122 @@
+//
+//  FileTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../libnrio/File.h"
+
+namespace nrcore {
+
+    static size_t sizeOnDisk(const std::string &path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return 0;
+        return (size_t)st.st_size;
+    }
+
+    static void testMappedAppends(UnitTest &test) {
+        std::string path = test.path("mapped.dat");
+        Memory data = UnitTest::pattern(100*1000, 3);
+        
+        {
+            File file(path.c_str(), true);
+            
+            // Small appends land in space extended ahead of them, the file only grows when the mapping does
+            for (size_t i=0; i<1000; i++)
+                file.write(i*100, data.operator char *()+i*100, 100);
+            
+            TEST_ASSERT(file.length() == 100*1000);
+            TEST_ASSERT(sizeOnDisk(path) == FILE_MAP_MIN_SIZE);
+            TEST_ASSERT(UnitTest::matches(file.read(0, 100*1000).operator char *(), 100*1000, 3));
+            
+            // Reads stop at the data written, not at the end of the space on disk
+            TEST_ASSERT(file.read(100*1000, 100).length() == 0);
+            
+            file.sync();
+            TEST_ASSERT(sizeOnDisk(path) == 100*1000);
+            
+            file.write(100*1000, data.operator char *(), 10);
+            TEST_ASSERT(file.length() == 100*1000+10);
+            TEST_ASSERT(sizeOnDisk(path) == FILE_MAP_MIN_SIZE);
+        }
+        
+        // Closing trims the file as well
+        TEST_ASSERT(sizeOnDisk(path) == 100*1000+10);
+        
+        File file(path.c_str(), true);
+        TEST_ASSERT(file.length() == 100*1000+10);
+        TEST_ASSERT(UnitTest::matches(file.read(0, 100*1000).operator char *(), 100*1000, 3));
+        TEST_ASSERT(UnitTest::matches(file.read(100*1000, 10).operator char *(), 10, 3));
+    }
+
+    static void testMappedGrowth(UnitTest &test) {
+        std::string path = test.path("growth.dat");
+        Memory data = UnitTest::pattern(64*1024, 4);
+        
+        // Writes past the mapping remap and extend the file to the new mapping, reserve leaves zeros
+        File file(path.c_str(), true);
+        size_t length = 0;
+        for (int i=0; i<40; i++) {
+            file.write(length, data.operator char *(), 64*1024);
+            length += 64*1024;
+        }
+        file.reserve(length+5000);
+        
+        TEST_ASSERT(file.length() == length+5000);
+        TEST_ASSERT(sizeOnDisk(path) >= length+5000);
+        
+        Memory tail = file.read(length, 5000);
+        bool zeros = tail.length() == 5000;
+        for (size_t i=0; zeros && i<5000; i++)
+            zeros = tail.operator char *()[i] == 0;
+        TEST_ASSERT(zeros);
+        
+        bool matched = true;
+        for (size_t i=0; i<length; i+=64*1024)
+            matched = matched && UnitTest::matches(file.read(i, 64*1024).operator char *(), 64*1024, 4);
+        TEST_ASSERT(matched);
+        
+        file.sync();
+        TEST_ASSERT(sizeOnDisk(path) == length+5000);
+    }
+
+    static void testBufferedWrites(UnitTest &test) {
+        std::string path = test.path("buffered.dat");
+        
+        {
+            File file(path.c_str());
+            file.write(0, UnitTest::pattern(1000, 5).operator char *(), 1000);
+        }
+        
+        {
+            // Writes inside the buffer stay there until it is flushed, here by closing the file
+            File file(path.c_str());
+            file.setFileUpdating(true);
+            file.write(100, UnitTest::pattern(50, 6).operator char *(), 50);
+            file.write(0, UnitTest::pattern(10, 7).operator char *(), 10);
+        }
+        
+        File file(path.c_str());
+        Memory data = file.read(0, 1000);
+        TEST_ASSERT(data.length() == 1000);
+        TEST_ASSERT(UnitTest::matches(data.operator char *(), 10, 7));
+        TEST_ASSERT(UnitTest::matches(data.operator char *()+10, 90, 5, 10));
+        TEST_ASSERT(UnitTest::matches(data.operator char *()+100, 50, 6));
+        TEST_ASSERT(UnitTest::matches(data.operator char *()+150, 850, 5, 150));
+    }
+
+    void testFile(UnitTest &test) {
+        test.run("file: mapped appends", testMappedAppends);
+        test.run("file: mapped growth", testMappedGrowth);
+        test.run("file: buffered writes", testBufferedWrites);
+    }
+
+}
@@ -0,0 +1,349 @@
+//
+//  FormatTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../libnrio/IndexedDataStore.h"
+
+namespace nrcore {
+
+    static Memory formatKey(char *buf, int index) {
+        // Shared prefixes and wide nodes, so chains, bank maps and prefix nodes are all created
+        int len = snprintf(buf, 64, "%c/%02x/key-with-a-long-shared-prefix/%d", 'a'+index%3, index%200, index);
+        return Memory(buf, len);
+    }
+
+    static void testLargeStore(UnitTest &test) {
+        std::string path = test.path("large.dat");
+        char key[64];
+        
+        {
+            IndexedDataStore store(path.c_str());
+            for (int i=0; i<100; i++)
+                store.set(formatKey(key, i), i);
+        }
+        
+        // A sparse file puts everything allocated from now on past 128 GiB, beyond 31 bit node numbers
+        unsigned long long gap = 128ULL*1024*1024*1024;
+        if (truncate(path.c_str(), (off_t)gap) != 0) {
+            fprintf(stderr, "  skipped, sparse files are not supported here\n");
+            return;
+        }
+        
+        {
+            IndexedDataStore store(path.c_str());
+            for (int i=100; i<2000; i++)
+                store.set(formatKey(key, i), i);
+            
+            bool found = true;
+            for (int i=0; i<2000; i++)
+                found = found && store.get<int>(formatKey(key, i)) == i;
+            TEST_ASSERT(found);
+        }
+        
+        {
+            IndexedDataStore store(path.c_str());
+            bool found = true;
+            for (int i=0; i<2000; i++)
+                found = found && store.get<int>(formatKey(key, i)) == i;
+            TEST_ASSERT(found);
+            
+            IndexedDataStore::Cursor cursor = store.scan(Memory("b/", 2));
+            int count = 0;
+            while (cursor.next())
+                count++;
+            TEST_ASSERT(count == 667);
+        }
+    }
+
+    static void testReopenResumesNodes(UnitTest &test) {
+        std::string path = test.path("reopen.dat");
+        char key[64];
+        
+        // Every reopen carries on allocating nodes where the superblock says, after prefix splits recycled some of them
+        for (int round=0; round<6; round++) {
+            IndexedDataStore store(path.c_str());
+            for (int i=round*300; i<(round+1)*300; i++)
+                store.set(formatKey(key, i), i);
+            for (int i=round*300; i<(round+1)*300; i+=7)
+                store.deleteFile(formatKey(key, i));
+        }
+        
+        IndexedDataStore store(path.c_str());
+        bool found = true;
+        for (int i=0; i<1800; i++) {
+            if (i%300%7 == 0)
+                found = found && !store.tryGetFile(formatKey(key, i)).getPtr();
+            else
+                found = found && store.get<int>(formatKey(key, i)) == i;
+        }
+        TEST_ASSERT(found);
+    }
+
+    // The layout a new store had before version 2, the root at 0 followed by the system and user nodes and the
+    // recycled blocks file. A store opened on it stays at version 1 and allocates everything in version 1 layouts.
+    static void createVersion1Store(const std::string &path) {
+        IndexedDataStore::INDEX_DESCRIPTOR nodes[3];
+        memset(nodes, 0, sizeof(nodes));
+        for (int i=0; i<3; i++)
+            nodes[i].magic_flag = MAGIC_FLAG_INDEX;
+        
+        nodes[0].slot[0] = sizeof(IndexedDataStore::INDEX_DESCRIPTOR);
+        nodes[0].slot[1] = sizeof(IndexedDataStore::INDEX_DESCRIPTOR)*2;
+        nodes[0].file = sizeof(IndexedDataStore::INDEX_DESCRIPTOR)*3;
+        
+        char recycled_blocks[offsetof(IndexedDataStore::FILE_DESCRIPTOR, block_index)];
+        memset(recycled_blocks, 0, sizeof(recycled_blocks));
+        
+        FILE *fp = fopen(path.c_str(), "wb");
+        fwrite(nodes, 1, sizeof(nodes), fp);
+        fwrite(recycled_blocks, 1, sizeof(recycled_blocks), fp);
+        fclose(fp);
+    }
+
+    static Memory upgradeKey(char *buf, int index) {
+        int len;
+        switch (index%4) {
+            case 0:  len = snprintf(buf, 64, "%08x", index*2654435761u); break;    // Wide nodes, bank maps
+            case 1:  len = snprintf(buf, 64, "user/profile/%d/name", index); break; // Chains below shared prefixes
+            case 2:  buf[0] = 'z'; buf[1] = (char)(index%256); buf[2] = (char)(index/256); len = 3; break; // Every byte value in one node
+            default: len = snprintf(buf, 64, "longcommonprefix_abcdefghijklmnopqrstuvwxyz_%d", index); break; // Prefix nodes
+        }
+        return Memory(buf, len);
+    }
+
+    static Memory upgradeValue(int index) {
+        // Inline values, single blocks and chains of blocks
+        size_t size = index%3 == 0 ? index%30 : (index*131)%9000;
+        return UnitTest::pattern(size, index);
+    }
+
+    static bool upgradeValuesMatch(IndexedDataStore &store, int count, int deleted_every) {
+        char key[64];
+        for (int i=0; i<count; i++) {
+            if (deleted_every && i%deleted_every == 0) {
+                if (store.tryGetFile(upgradeKey(key, i)).getPtr())
+                    return false;
+                continue;
+            }
+            
+            Memory expected = upgradeValue(i);
+            Memory value = store.read(upgradeKey(key, i), 10000);
+            if (value.length() != expected.length() || memcmp(value.operator char *(), expected.operator char *(), value.length()))
+                return false;
+        }
+        return true;
+    }
+
+    static Memory uncleanKey(char *buf, int index) {
+        // Keys in a part of the trie of their own, each one needs new index nodes
+        return Memory(buf, snprintf(buf, 64, "unclean/%d", index));
+    }
+
+    // Opens a copy of the store taken while it was open, as a crash would leave it
+    static bool crashedStoreMatches(const std::string &crashed, int format_keys, int unclean_keys) {
+        char key[64];
+        IndexedDataStore store(crashed.c_str());
+        
+        // New nodes go to a new extent instead of over the ones allocated since the superblock was written
+        for (int i=1000; i<1300; i++)
+            store.set(formatKey(key, i), i);
+        
+        bool found = true;
+        for (int i=0; i<format_keys; i++)
+            found = found && store.get<int>(formatKey(key, i)) == i;
+        for (int i=1000; i<1300; i++)
+            found = found && store.get<int>(formatKey(key, i)) == i;
+        for (int i=0; i<unclean_keys; i++)
+            found = found && store.get<int>(uncleanKey(key, i)) == i;
+        return found;
+    }
+
+    static void testUncleanShutdown(UnitTest &test) {
+        std::string path = test.path("unclean.dat");
+        std::string direct = test.path("unclean-direct.dat");
+        std::string batched = test.path("unclean-batched.dat");
+        char key[64];
+        
+        {
+            IndexedDataStore store(path.c_str());
+            for (int i=0; i<300; i++)
+                store.set(formatKey(key, i), i);
+        }
+        
+        {
+            // A few nodes past what the superblock holds, after a clean close and after a commit
+            IndexedDataStore store(path.c_str());
+            for (int i=0; i<3; i++)
+                store.set(uncleanKey(key, i), i);
+            test.copy(path, direct);
+            
+            store.beginBatch();
+            for (int i=300; i<600; i++)
+                store.set(formatKey(key, i), i);
+            store.commit();
+            for (int i=3; i<6; i++)
+                store.set(uncleanKey(key, i), i);
+            test.copy(path, batched);
+            test.copy(path + ".wal", batched + ".wal");
+        }
+        
+        TEST_ASSERT(crashedStoreMatches(direct, 300, 3));
+        TEST_ASSERT(crashedStoreMatches(batched, 600, 6));
+    }
+
+    static void testUpgrade(UnitTest &test) {
+        char key[64];
+        
+        for (int mapped=0; mapped<2; mapped++) {
+            std::string path = test.path(mapped ? "upgrade-mapped.dat" : "upgrade.dat");
+            createVersion1Store(path);
+            
+            {
+                IndexedDataStore store(path.c_str(), DESCRIPTOR_CACHE_SIZE, mapped);
+                TEST_ASSERT(store.getFormatVersion() == 1);
+                
+                for (int i=0; i<4000; i++)
+                    store.set(upgradeKey(key, i), upgradeValue(i));
+                for (int i=0; i<4000; i+=7)
+                    store.deleteFile(upgradeKey(key, i));
+                TEST_ASSERT(upgradeValuesMatch(store, 4000, 7));
+                
+                TEST_ASSERT(store.upgradeFormat());
+                TEST_ASSERT(store.getFormatVersion() == STORE_FORMAT_VERSION);
+                TEST_ASSERT(!store.upgradeFormat());
+                TEST_ASSERT(upgradeValuesMatch(store, 4000, 7));
+            }
+            
+            {
+                IndexedDataStore store(path.c_str(), DESCRIPTOR_CACHE_SIZE, mapped);
+                TEST_ASSERT(store.getFormatVersion() == STORE_FORMAT_VERSION);
+                TEST_ASSERT(upgradeValuesMatch(store, 4000, 7));
+                
+                // Deleted keys come back and new ones are added in the new layout
+                for (int i=0; i<4000; i+=7)
+                    store.set(upgradeKey(key, i), upgradeValue(i));
+                for (int i=4000; i<5000; i++)
+                    store.set(upgradeKey(key, i), upgradeValue(i));
+            }
+            
+            {
+                IndexedDataStore store(path.c_str(), DESCRIPTOR_CACHE_SIZE, mapped);
+                TEST_ASSERT(upgradeValuesMatch(store, 5000, 0));
+                
+                IndexedDataStore::Cursor cursor = store.scan(Memory("user/profile/", 13));
+                int count = 0;
+                while (cursor.next())
+                    count++;
+                TEST_ASSERT(count == 1250);
+            }
+        }
+    }
+
+    static size_t sizeOnDisk(const std::string &path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return 0;
+        return (size_t)st.st_size;
+    }
+
+    static void testUpgradeRecyclesIndex(UnitTest &test) {
+        std::string path = test.path("recycled.dat");
+        char key[64];
+        createVersion1Store(path);
+        
+        {
+            IndexedDataStore store(path.c_str());
+            for (int i=0; i<4000; i++)
+                store.set(upgradeKey(key, i), i);
+            TEST_ASSERT(store.upgradeFormat());
+        }
+        size_t upgraded = sizeOnDisk(path);
+        
+        // Each round deletes the keys of the last one and adds as many new ones. Their value records come back from
+        // the deleted keys and their nodes from the old index, so the store does not grow while the old index lasts.
+        for (int round=0; round<4; round++) {
+            IndexedDataStore store(path.c_str());
+            for (int i=round*500; i<(round+1)*500; i++)
+                store.deleteFile(upgradeKey(key, i));
+            for (int i=(round+1)*500; i<(round+2)*500; i++)
+                store.set(upgradeKey(key, 4000+i), i);
+        }
+        TEST_ASSERT(sizeOnDisk(path) <= upgraded+NODE_EXTENT_SIZE);
+        
+        IndexedDataStore store(path.c_str());
+        bool found = true;
+        for (int i=2000; i<4000; i++)
+            found = found && store.get<int>(upgradeKey(key, i)) == i;
+        for (int i=500; i<2500; i++)
+            found = found && store.get<int>(upgradeKey(key, 4000+i)) == i;
+        TEST_ASSERT(found);
+    }
+
+    static bool legacyFileMatches(IndexedDataStore &store) {
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(Memory("legacy", 6));
+        if (store.getFileSize(file) != 1200)
+            return false;
+        
+        Memory data = store.readFromFile(file, 0, 1200);
+        return UnitTest::matches(data.operator char *(), 1000, 1) && UnitTest::matches(data.operator char *()+1000, 200, 2);
+    }
+
+    static void testLegacyFileWrites(UnitTest &test) {
+        std::string path = test.path("legacy.dat");
+        Memory key("legacy", 6);
+        unsigned long long offset;
+        
+        {
+            IndexedDataStore store(path.c_str());
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(key, 64);
+            store.writeToFile(file, UnitTest::pattern(1000, 1), 0, 1000);
+            offset = file.getPtr()->offset;
+        }
+        
+        {
+            // The blocks are chained as well, with the old magic the file reads as one written before block indexes
+            File raw(path.c_str());
+            uint32_t magic = MAGIC_FLAG_FILE;
+            raw.write((size_t)offset, (const char*)&magic, sizeof(magic));
+        }
+        
+        {
+            IndexedDataStore store(path.c_str());
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> stale = store.getFile(key);
+            TEST_ASSERT(stale.getPtr()->descriptor.magic_flag == MAGIC_FLAG_FILE);
+            
+            // A writer opening the key moves the file to a new descriptor, the reader's copy still points at the old one
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> upgraded = store.getOrCreateFile(key, 64);
+            TEST_ASSERT(upgraded.getPtr()->descriptor.magic_flag == MAGIC_FLAG_INDEXED_FILE);
+            TEST_ASSERT(upgraded.getPtr()->offset != offset);
+            
+            store.writeToFile(stale, UnitTest::pattern(500, 2), 1000, 500);
+            TEST_ASSERT(stale.getPtr()->offset == upgraded.getPtr()->offset);
+            TEST_ASSERT(store.truncateFile(stale, 1200));
+            TEST_ASSERT(legacyFileMatches(store));
+        }
+        
+        IndexedDataStore store(path.c_str());
+        TEST_ASSERT(legacyFileMatches(store));
+    }
+
+    void testFormat(UnitTest &test) {
+        test.run("format: node links past 128 GiB", testLargeStore);
+        test.run("format: node allocation resumes after reopening", testReopenResumesNodes);
+        test.run("format: node allocation after an unclean shutdown", testUncleanShutdown);
+        test.run("format: upgrade from version 1", testUpgrade);
+        test.run("format: an upgrade recycles the old index", testUpgradeRecyclesIndex);
+        test.run("format: writes through a descriptor moved by an upgrade", testLegacyFileWrites);
+    }
+
+}
@@ -0,0 +1,120 @@
+//
+//  ParallelReadTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "../libnrio/IndexedDataStore.h"
+
+#define READ_BLOCK_SIZE 512
+#define SERIAL_READ_SIZE 4096
+
+namespace nrcore {
+
+    // Reads below PARALLEL_READ_SIZE go block by block through the chain, they are what the parallel path must match
+    static unsigned long long readSerial(IndexedDataStore &store, Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, char *buffer, unsigned long long length) {
+        unsigned long long done = 0;
+        while (done < length) {
+            unsigned long long len = length-done < SERIAL_READ_SIZE ? length-done : SERIAL_READ_SIZE;
+            unsigned long long got = store.readFromFile(file, offset+done, buffer+done, len);
+            done += got;
+            if (got < len)
+                break;
+        }
+        return done;
+    }
+
+    // Offsets and lengths around the leaves of the block index and the windows of the parallel read
+    static bool readsMatch(IndexedDataStore &store, Memory key) {
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(key);
+        unsigned long long size = store.getFileSize(file);
+        unsigned long long leaf = BLOCK_INDEX_SIZE*READ_BLOCK_SIZE;
+        unsigned long long window = PARALLEL_READ_WINDOW*READ_BLOCK_SIZE;
+        
+        unsigned long long reads[][2] = {
+            {0, size},
+            {1, size-1},
+            {leaf-1, PARALLEL_READ_SIZE},
+            {leaf, PARALLEL_READ_SIZE+1},
+            {window-5, PARALLEL_READ_SIZE+leaf+7},
+            {window*2+READ_BLOCK_SIZE-1, PARALLEL_READ_SIZE},
+            {READ_BLOCK_SIZE*320+17, size},         // Runs past the end of the file
+            {size-1000, PARALLEL_READ_SIZE},
+        };
+        
+        for (size_t i=0; i<sizeof(reads)/sizeof(reads[0]); i++) {
+            unsigned long long offset = reads[i][0];
+            unsigned long long length = reads[i][1];
+            
+            std::vector<char> parallel(length, 1);
+            std::vector<char> serial(length, 2);
+            unsigned long long parallel_len = store.readFromFile(file, offset, &parallel[0], length);
+            unsigned long long serial_len = readSerial(store, file, offset, &serial[0], length);
+            
+            if (parallel_len != serial_len || parallel_len != (offset+length > size ? size-offset : length))
+                return false;
+            if (memcmp(&parallel[0], &serial[0], (size_t)parallel_len) != 0)
+                return false;
+        }
+        
+        return true;
+    }
+
+    static void createFiles(IndexedDataStore &store) {
+        size_t size = READ_BLOCK_SIZE*1100+300;
+        
+        // One run of blocks appended together
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(Memory("contiguous", 10), READ_BLOCK_SIZE);
+        store.writeToFile(file, UnitTest::pattern(size, 1), 0, size);
+        
+        // Blocks interleaved with another file's, so no two neighbours are next to each other in the store
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> scattered = store.createFile(Memory("scattered", 9), READ_BLOCK_SIZE);
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> other = store.createFile(Memory("other", 5), READ_BLOCK_SIZE);
+        Memory data = UnitTest::pattern(size, 2);
+        for (size_t done=0; done<size; done+=700) {
+            size_t len = size-done < 700 ? size-done : 700;
+            store.writeToFile(scattered, data.operator char *()+done, done, len);
+            store.writeToFile(other, data.operator char *()+done, done, len);
+        }
+        
+        // Hole blocks between two written ranges
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> sparse = store.createFile(Memory("sparse", 6), READ_BLOCK_SIZE);
+        store.writeToFile(sparse, UnitTest::pattern(100, 3), 0, 100);
+        store.writeToFile(sparse, UnitTest::pattern(READ_BLOCK_SIZE*100, 3), size-READ_BLOCK_SIZE*100, READ_BLOCK_SIZE*100);
+    }
+
+    static void testParallelReads(UnitTest &test) {
+        std::string path = test.path("parallel.dat");
+        
+        {
+            IndexedDataStore store(path.c_str());
+            createFiles(store);
+            
+            // The first pass fills the descriptor cache, the second is answered from it
+            for (int pass=0; pass<2; pass++) {
+                TEST_ASSERT(readsMatch(store, Memory("contiguous", 10)));
+                TEST_ASSERT(readsMatch(store, Memory("scattered", 9)));
+                TEST_ASSERT(readsMatch(store, Memory("sparse", 6)));
+            }
+        }
+        
+        // Without a cache every descriptor is read by the parallel path itself
+        IndexedDataStore store(path.c_str(), 0);
+        TEST_ASSERT(readsMatch(store, Memory("contiguous", 10)));
+        TEST_ASSERT(readsMatch(store, Memory("scattered", 9)));
+        TEST_ASSERT(readsMatch(store, Memory("sparse", 6)));
+    }
+
+    void testParallelRead(UnitTest &test) {
+        test.run("parallel read: matches the serial path", testParallelReads);
+    }
+
+}
@@ -0,0 +1,124 @@
+//
+//  SparseFileTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+
+#include "../libnrio/IndexedDataStore.h"
+
+namespace nrcore {
+
+    static bool isZero(const char *data, size_t length) {
+        for (size_t i=0; i<length; i++) {
+            if (data[i])
+                return false;
+        }
+        return true;
+    }
+
+    // The file holds seed 1 up to kept, zeros up to gap and then tail bytes of seed 2
+    static bool sparseMatches(IndexedDataStore &store, Memory key, size_t kept, size_t gap, size_t tail) {
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(key);
+        if (store.getFileSize(file) != gap+tail)
+            return false;
+        
+        Memory data = store.readFromFile(file, 0, gap+tail);
+        const char *ptr = data.operator char *();
+        return data.length() == gap+tail && UnitTest::matches(ptr, kept, 1) && isZero(ptr+kept, gap-kept) && UnitTest::matches(ptr+gap, tail, 2);
+    }
+
+    static void testWritePastEnd(UnitTest &test) {
+        std::string path = test.path("past-end.dat");
+        Memory plain("plain", 5);
+        Memory compressed("compressed", 10);
+        Memory inline_value("inline", 6);
+        Memory converted("converted", 9);
+        
+        {
+            IndexedDataStore store(path.c_str());
+            
+            // Gaps inside the last block and over several whole blocks
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(plain, 64);
+            store.writeToFile(file, UnitTest::pattern(100, 1), 0, 100);
+            store.writeToFile(file, UnitTest::pattern(50, 2), 1000, 50);
+            TEST_ASSERT(sparseMatches(store, plain, 100, 1000, 50));
+            
+            file = store.createFile(compressed, 256, FILE_FLAG_COMPRESSED);
+            store.writeToFile(file, UnitTest::pattern(100, 1), 0, 100);
+            store.writeToFile(file, UnitTest::pattern(50, 2), 1000, 50);
+            TEST_ASSERT(sparseMatches(store, compressed, 100, 1000, 50));
+            
+            // A gap that still fits in the value record, and one that moves the value to data blocks
+            store.set(inline_value, UnitTest::pattern(10, 1));
+            file = store.getFile(inline_value);
+            store.writeToFile(file, UnitTest::pattern(5, 2), 20, 5);
+            TEST_ASSERT(file.getPtr()->descriptor.magic_flag == MAGIC_FLAG_VALUE_FILE);
+            TEST_ASSERT(sparseMatches(store, inline_value, 10, 20, 5));
+            
+            store.set(converted, UnitTest::pattern(10, 1));
+            file = store.getFile(converted);
+            store.writeToFile(file, UnitTest::pattern(40, 2), 300, 40);
+            TEST_ASSERT(file.getPtr()->descriptor.magic_flag != MAGIC_FLAG_VALUE_FILE);
+            TEST_ASSERT(sparseMatches(store, converted, 10, 300, 40));
+        }
+        
+        IndexedDataStore store(path.c_str());
+        TEST_ASSERT(sparseMatches(store, plain, 100, 1000, 50));
+        TEST_ASSERT(sparseMatches(store, compressed, 100, 1000, 50));
+        TEST_ASSERT(sparseMatches(store, inline_value, 10, 20, 5));
+        TEST_ASSERT(sparseMatches(store, converted, 10, 300, 40));
+    }
+
+    static void truncateAndExtend(IndexedDataStore &store, Memory key, size_t kept, size_t gap) {
+        // The bytes cut off are still in the last block kept, extending must not bring them back
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(key);
+        store.writeToFile(file, UnitTest::pattern(1000, 1), 0, 1000);
+        store.truncateFile(file, kept);
+        store.writeToFile(file, UnitTest::pattern(30, 2), gap, 30);
+    }
+
+    static void testTruncateAndExtend(UnitTest &test) {
+        std::string path = test.path("truncate.dat");
+        
+        {
+            IndexedDataStore store(path.c_str());
+            store.createFile(Memory("mid-block", 9), 64);
+            store.createFile(Memory("on-boundary", 11), 64);
+            store.createFile(Memory("emptied", 7), 64);
+            store.createFile(Memory("compressed", 10), 256, FILE_FLAG_COMPRESSED);
+            store.set(Memory("value", 5), UnitTest::pattern(20, 1));
+            
+            truncateAndExtend(store, Memory("mid-block", 9), 130, 2000);
+            truncateAndExtend(store, Memory("on-boundary", 11), 128, 150);
+            truncateAndExtend(store, Memory("emptied", 7), 0, 500);
+            truncateAndExtend(store, Memory("compressed", 10), 300, 900);
+            
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> value = store.getFile(Memory("value", 5));
+            store.truncateFile(value, 5);
+            store.writeToFile(value, UnitTest::pattern(4, 2), 25, 4);
+            
+            TEST_ASSERT(sparseMatches(store, Memory("mid-block", 9), 130, 2000, 30));
+            TEST_ASSERT(sparseMatches(store, Memory("on-boundary", 11), 128, 150, 30));
+            TEST_ASSERT(sparseMatches(store, Memory("emptied", 7), 0, 500, 30));
+            TEST_ASSERT(sparseMatches(store, Memory("compressed", 10), 300, 900, 30));
+            TEST_ASSERT(sparseMatches(store, Memory("value", 5), 5, 25, 4));
+        }
+        
+        IndexedDataStore store(path.c_str());
+        TEST_ASSERT(sparseMatches(store, Memory("mid-block", 9), 130, 2000, 30));
+        TEST_ASSERT(sparseMatches(store, Memory("compressed", 10), 300, 900, 30));
+        TEST_ASSERT(sparseMatches(store, Memory("value", 5), 5, 25, 4));
+    }
+
+    void testSparseFiles(UnitTest &test) {
+        test.run("sparse: writes past the end of a file", testWritePastEnd);
+        test.run("sparse: truncate then extend", testTruncateAndExtend);
+    }
+
+}
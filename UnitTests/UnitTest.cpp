@@ -0,0 +1,115 @@
+//
+//  UnitTest.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace nrcore {
+
+    int UnitTest::failed_checks = 0;
+
+    UnitTest::UnitTest() : failures(0) {
+        const char *tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/nrio-tests.XXXXXX";
+        
+        std::vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back(0);
+        if (!mkdtemp(&buf[0]))
+            throw "Failed to create test directory";
+        
+        dir = &buf[0];
+    }
+
+    UnitTest::~UnitTest() {
+        reset();
+        rmdir(dir.c_str());
+    }
+
+    std::string UnitTest::path(const char *name) {
+        std::string ret = dir + "/" + name;
+        files.push_back(ret);
+        files.push_back(ret + ".wal");
+        files.push_back(ret + ".compact");
+        return ret;
+    }
+
+    void UnitTest::copy(const std::string &from, const std::string &to) {
+        unlink(to.c_str());
+        
+        FILE *in = fopen(from.c_str(), "rb");
+        if (!in)
+            return;
+        
+        FILE *out = fopen(to.c_str(), "wb");
+        if (!out) {
+            fclose(in);
+            throw "Failed to copy test file";
+        }
+        
+        char buf[65536];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+            fwrite(buf, 1, len, out);
+        
+        fclose(in);
+        fclose(out);
+    }
+
+    void UnitTest::reset() {
+        for (size_t i=0; i<files.size(); i++)
+            unlink(files[i].c_str());
+        files.clear();
+    }
+
+    void UnitTest::run(const char *name, TestFunction function) {
+        int before = failed_checks;
+        
+        try {
+            function(*this);
+        } catch (const char *e) {
+            fprintf(stderr, "  exception: %s\n", e);
+            failed_checks++;
+        }
+        reset();
+        
+        bool passed = failed_checks == before;
+        if (!passed)
+            failures++;
+        fprintf(stderr, "%s %s\n", passed ? "PASS" : "FAIL", name);
+    }
+
+    int UnitTest::getFailures() {
+        return failures;
+    }
+
+    void UnitTest::check(bool condition, const char *expression, const char *file, int line) {
+        if (condition)
+            return;
+        
+        fprintf(stderr, "  %s:%d: %s\n", file, line, expression);
+        failed_checks++;
+    }
+
+    Memory UnitTest::pattern(size_t length, unsigned int seed) {
+        Memory ret(length);
+        for (size_t i=0; i<length; i++)
+            ret.operator char *()[i] = (char)((i*31 + seed*17 + (i>>8)) & 0xFF);
+        return ret;
+    }
+
+    bool UnitTest::matches(const char *data, size_t length, unsigned int seed, size_t offset) {
+        for (size_t i=0; i<length; i++) {
+            if (data[i] != (char)(((i+offset)*31 + seed*17 + ((i+offset)>>8)) & 0xFF))
+                return false;
+        }
+        return true;
+    }
+
+}
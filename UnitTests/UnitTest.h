@@ -0,0 +1,66 @@
+//
+//  UnitTest.h
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef UnitTest_hpp
+#define UnitTest_hpp
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <libnrcore/memory/Memory.h>
+
+#define TEST_ASSERT(condition) nrcore::UnitTest::check((condition), #condition, __FILE__, __LINE__)
+
+namespace nrcore {
+
+    // Runs the test functions of the suites and counts failed checks, a failed check does not stop its test.
+    // Files are created in a private temporary directory that is removed with everything in it afterwards.
+    class UnitTest {
+    public:
+        typedef void (*TestFunction)(UnitTest &test);
+        
+        UnitTest();
+        virtual ~UnitTest();
+        
+        std::string path(const char *name);
+        void copy(const std::string &from, const std::string &to); // A missing file removes to
+        void reset(); // Removes the files created so far
+        
+        void run(const char *name, TestFunction function);
+        int getFailures();
+        
+        static void check(bool condition, const char *expression, const char *file, int line);
+        
+        // Deterministic contents for the data written by tests
+        static Memory pattern(size_t length, unsigned int seed);
+        static bool matches(const char *data, size_t length, unsigned int seed, size_t offset=0);
+        
+    private:
+        std::string dir;
+        std::vector<std::string> files;
+        int failures;
+        
+        static int failed_checks;
+    };
+
+    // Suites, each in its own file
+    void testWriteAheadLog(UnitTest &test);
+    void testFormat(UnitTest &test);
+    void testConcurrency(UnitTest &test);
+    void testCursor(UnitTest &test);
+    void testFile(UnitTest &test);
+    void testCodec(UnitTest &test);
+    void testSparseFiles(UnitTest &test);
+    void testParallelRead(UnitTest &test);
+    void testValues(UnitTest &test);
+
+}
+
+#endif /* UnitTest_hpp */
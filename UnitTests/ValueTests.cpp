@@ -0,0 +1,120 @@
+//
+//  ValueTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+
+#include "../libnrio/IndexedDataStore.h"
+
+namespace nrcore {
+
+    typedef struct {
+        int x;
+        double y;
+        short z;
+    } POINT;
+
+    static bool throwsOnGet(IndexedDataStore &store, const char *key) {
+        try {
+            store.get<int>(Memory(key, strlen(key)));
+            return false;
+        } catch (const char *) {
+            return true;
+        }
+    }
+
+    static bool typedValuesMatch(IndexedDataStore &store) {
+        POINT p = store.get<POINT>(Memory("point", 5));
+        bool ok = store.get<int>(Memory("int", 3)) == -42 && store.readInt(Memory("int", 3)) == -42;
+        ok = ok && store.get<unsigned int>(Memory("uint", 4)) == 7u;
+        ok = ok && store.readLongLong(Memory("longlong", 8)) == -5000000000LL;
+        ok = ok && store.get<unsigned long long>(Memory("ulonglong", 9)) == 0xFFFFFFFFFFULL;
+        ok = ok && store.get<double>(Memory("double", 6)) == 0.125;
+        ok = ok && p.x == 1 && p.y == 2.5 && p.z == 3;
+        
+        char key[16];
+        for (int i=0; i<2000; i++)
+            ok = ok && store.get<long long>(Memory(key, snprintf(key, sizeof(key), "n%05d", i))) == i*3LL;
+        return ok;
+    }
+
+    static void testTypedRoundTrip(UnitTest &test) {
+        for (int mapped=0; mapped<2; mapped++) {
+            std::string path = test.path(mapped ? "typed-mapped.dat" : "typed.dat");
+            
+            {
+                IndexedDataStore store(path.c_str(), DESCRIPTOR_CACHE_SIZE, mapped);
+                POINT p = {1, 2.5, 3};
+                store.set(Memory("int", 3), -42);
+                store.set(Memory("uint", 4), 7u);
+                store.set(Memory("longlong", 8), -5000000000LL);
+                store.set(Memory("ulonglong", 9), 0xFFFFFFFFFFULL);
+                store.set(Memory("double", 6), 0.125);
+                store.set(Memory("point", 5), p);
+                
+                char key[16];
+                for (int i=0; i<2000; i++)
+                    store.set(Memory(key, snprintf(key, sizeof(key), "n%05d", i)), i*3LL);
+                
+                TEST_ASSERT(typedValuesMatch(store));
+                TEST_ASSERT(throwsOnGet(store, "missing"));
+            }
+            
+            IndexedDataStore store(path.c_str(), DESCRIPTOR_CACHE_SIZE, mapped);
+            TEST_ASSERT(typedValuesMatch(store));
+        }
+    }
+
+    static void testShortValues(UnitTest &test) {
+        IndexedDataStore store(test.path("short.dat").c_str());
+        
+        // The bytes a stored value does not have read back as zeros
+        store.set(Memory("short", 5), (short)-1);
+        TEST_ASSERT(store.get<long long>(Memory("short", 5)) == 0xFFFF);
+        
+        store.set(Memory("bytes", 5), Memory("\x01\x02\x03", 3));
+        TEST_ASSERT(store.get<int>(Memory("bytes", 5)) == 0x030201);
+        
+        store.set(Memory("empty", 5), Memory());
+        TEST_ASSERT(store.get<int>(Memory("empty", 5)) == 0);
+        
+        // readOrSet keeps a value that covers the type and replaces one that is too short
+        TEST_ASSERT(store.readOrSet(Memory("new", 3), 99) == 99);
+        TEST_ASSERT(store.readOrSet(Memory("new", 3), 5) == 99);
+        TEST_ASSERT(store.readOrSet(Memory("short", 5), 12345678LL) == 12345678LL);
+        TEST_ASSERT(store.get<long long>(Memory("short", 5)) == 12345678LL);
+    }
+
+    static void testValuesInDataBlocks(UnitTest &test) {
+        IndexedDataStore store(test.path("blocks.dat").c_str());
+        
+        // A value too large for its record is read through its data blocks, typed reads take its first bytes
+        Memory big = UnitTest::pattern(5000, 5);
+        store.set(Memory("big", 3), big);
+        int first;
+        memcpy(&first, big.operator char *(), sizeof(int));
+        TEST_ASSERT(store.get<int>(Memory("big", 3)) == first);
+        
+        Memory data = store.read(Memory("big", 3), 5000);
+        TEST_ASSERT(data.length() == 5000 && UnitTest::matches(data.operator char *(), 5000, 5));
+        
+        // A typed write replaces the start of the file and leaves the rest
+        store.set(Memory("big", 3), 77);
+        TEST_ASSERT(store.get<int>(Memory("big", 3)) == 77);
+        data = store.read(Memory("big", 3), 5000);
+        TEST_ASSERT(data.length() == 5000 && UnitTest::matches(data.operator char *()+4, 4996, 5, 4));
+    }
+
+    void testValues(UnitTest &test) {
+        test.run("values: typed round trip", testTypedRoundTrip);
+        test.run("values: short values", testShortValues);
+        test.run("values: values in data blocks", testValuesInDataBlocks);
+    }
+
+}
@@ -0,0 +1,253 @@
+//
+//  WriteAheadLogTests.cpp
+//  UnitTests
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "UnitTest.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "../libnrio/IndexedDataStore.h"
+#include "../libnrio/File.h"
+
+namespace nrcore {
+
+    static bool hasValue(IndexedDataStore &store, const char *key, int expected) {
+        try {
+            return store.get<int>(Memory(key, strlen(key))) == expected;
+        } catch (const char *) {
+            return false;
+        }
+    }
+
+    static bool hasKey(IndexedDataStore &store, const char *key) {
+        try {
+            store.read(Memory(key, strlen(key)), 1);
+            return true;
+        } catch (const char *) {
+            return false;
+        }
+    }
+
+    // True when another thread can take the write lock, so no batch level was left holding it
+    static bool lockIsFree(IndexedDataStore &store) {
+        std::atomic<bool> done(false);
+        std::thread writer([&store, &done]() {
+            store.set(Memory("lock", 4), 1);
+            done = true;
+        });
+        
+        for (int i=0; i<500 && !done; i++)
+            usleep(10000);
+        
+        if (!done) {
+            writer.detach();
+            return false;
+        }
+        writer.join();
+        return true;
+    }
+
+    static void testNestedRollback(UnitTest &test) {
+        IndexedDataStore store(test.path("nested.dat").c_str());
+        
+        store.beginBatch();
+        store.set(Memory("outer1", 6), 1);
+        
+        store.beginBatch();
+        store.set(Memory("inner", 5), 2);
+        store.set(Memory("outer1", 6), 3);
+        store.rollback();
+        
+        // The outer batch still sees its own writes and none of the inner ones
+        TEST_ASSERT(hasValue(store, "outer1", 1));
+        TEST_ASSERT(!hasKey(store, "inner"));
+        
+        store.beginBatch();
+        store.set(Memory("kept", 4), 4);
+        store.commit();
+        
+        store.set(Memory("outer2", 6), 5);
+        store.commit();
+        
+        TEST_ASSERT(hasValue(store, "outer1", 1));
+        TEST_ASSERT(hasValue(store, "outer2", 5));
+        TEST_ASSERT(hasValue(store, "kept", 4));
+        TEST_ASSERT(!hasKey(store, "inner"));
+        TEST_ASSERT(lockIsFree(store));
+        
+        // Rolling back the outermost batch still discards everything
+        store.beginBatch();
+        store.set(Memory("dropped", 7), 6);
+        store.beginBatch();
+        store.set(Memory("dropped2", 8), 7);
+        store.commit();
+        store.rollback();
+        
+        TEST_ASSERT(!hasKey(store, "dropped"));
+        TEST_ASSERT(!hasKey(store, "dropped2"));
+        TEST_ASSERT(lockIsFree(store));
+    }
+
+    static void testFailedSetManyInBatch(UnitTest &test) {
+        std::string path = test.path("setmany.dat");
+        IndexedDataStore store(path.c_str(), 0);
+        
+        Memory big = UnitTest::pattern(5000, 1);
+        store.set(Memory("bad", 3), big);
+        unsigned long long block = store.getFile(Memory("bad", 3)).getPtr()->descriptor.first_data_block;
+        
+        // Damages the data block of "bad" so that setMany fails part way through its writes
+        unsigned int garbage = 0x12345678;
+        {
+            File raw(path.c_str());
+            raw.write((size_t)block, (const char*)&garbage, sizeof(garbage));
+        }
+        
+        store.beginBatch();
+        store.set(Memory("before", 6), 10);
+        
+        Array<Memory> keys;
+        Array<Memory> values;
+        keys.push(Memory("a-new", 5));
+        keys.push(Memory("bad", 3));
+        keys.push(Memory("z-new", 5));
+        for (int i=0; i<3; i++)
+            values.push(UnitTest::pattern(5000, i+2));
+        
+        bool threw = false;
+        try {
+            store.setMany(keys, values);
+        } catch (const char *) {
+            threw = true;
+        }
+        TEST_ASSERT(threw);
+        
+        // The caller's batch is intact and still open
+        TEST_ASSERT(hasValue(store, "before", 10));
+        TEST_ASSERT(!hasKey(store, "a-new"));
+        TEST_ASSERT(!hasKey(store, "z-new"));
+        
+        store.set(Memory("after", 5), 11);
+        store.commit();
+        
+        TEST_ASSERT(hasValue(store, "before", 10));
+        TEST_ASSERT(hasValue(store, "after", 11));
+        TEST_ASSERT(!hasKey(store, "a-new"));
+        TEST_ASSERT(lockIsFree(store));
+    }
+
+    static void testReplayAfterCrash(UnitTest &test) {
+        std::string path = test.path("crash.dat");
+        std::string before = test.path("crash-before.dat");
+        std::string recovered = test.path("crash-recovered.dat");
+        std::string torn = test.path("crash-torn.dat");
+        
+        {
+            IndexedDataStore store(path.c_str());
+            for (int i=0; i<20; i++) {
+                char key[16];
+                snprintf(key, sizeof(key), "base%02d", i);
+                store.set(Memory(key, strlen(key)), i);
+            }
+            
+            // Nothing is left in the log by direct writes, a copy now is the store as a crash would leave it
+            test.copy(path, before);
+            
+            store.beginBatch();
+            store.set(Memory("base00", 6), 100);
+            store.set(Memory("batch", 5), UnitTest::pattern(10000, 7));
+            store.beginBatch();
+            store.set(Memory("rolled-back", 11), 1);
+            store.rollback();
+            store.beginBatch();
+            store.set(Memory("nested", 6), 2);
+            store.commit();
+            store.commit();
+            
+            // The store as it would be found if the process died before the commit reached it
+            test.copy(before, recovered);
+            test.copy(path + ".wal", recovered + ".wal");
+            test.copy(before, torn);
+            test.copy(path + ".wal", torn + ".wal");
+        }
+        
+        {
+            IndexedDataStore store(recovered.c_str());
+            TEST_ASSERT(hasValue(store, "base00", 100));
+            TEST_ASSERT(hasValue(store, "base19", 19));
+            TEST_ASSERT(hasValue(store, "nested", 2));
+            TEST_ASSERT(!hasKey(store, "rolled-back"));
+            
+            Memory data = store.read(Memory("batch", 5), 10000);
+            TEST_ASSERT(data.length() == 10000 && UnitTest::matches(data.operator char *(), 10000, 7));
+        }
+        
+        // A record cut short by the crash was never committed and is ignored
+        FILE *fp = fopen((torn + ".wal").c_str(), "r+");
+        fseek(fp, 0L, SEEK_END);
+        long size = ftell(fp);
+        fclose(fp);
+        TEST_ASSERT(size > 0 && truncate((torn + ".wal").c_str(), size-1) == 0);
+        
+        {
+            IndexedDataStore store(torn.c_str());
+            TEST_ASSERT(hasValue(store, "base00", 0));
+            TEST_ASSERT(!hasKey(store, "batch"));
+            TEST_ASSERT(!hasKey(store, "nested"));
+        }
+    }
+
+    static void testReplayReservedSpace(UnitTest &test) {
+        std::string path = test.path("reserve.dat");
+        std::string recovered = test.path("reserve-recovered.dat");
+        
+        {
+            IndexedDataStore store(path.c_str());
+            Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(Memory("sparse", 6), 64);
+            store.writeToFile(file, UnitTest::pattern(100, 1), 0, 100);
+            test.copy(path, recovered);
+            
+            // The hole blocks at the end of the store are only claimed by the batch, their data is never written
+            store.beginBatch();
+            store.writeToFile(file, UnitTest::pattern(10, 2), 20000, 10);
+            store.commit();
+            
+            test.copy(path + ".wal", recovered + ".wal");
+        }
+        
+        IndexedDataStore store(recovered.c_str());
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.getFile(Memory("sparse", 6));
+        TEST_ASSERT(store.getFileSize(file) == 20010);
+        
+        // Whatever is allocated after the replay lies past the reserved space
+        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> after = store.createFile(Memory("after", 5), 64);
+        store.writeToFile(after, UnitTest::pattern(5000, 3), 0, 5000);
+        
+        Memory data = store.readFromFile(file, 0, 20010);
+        bool zeros = data.length() == 20010;
+        for (size_t i=100; zeros && i<20000; i++)
+            zeros = data.operator char *()[i] == 0;
+        TEST_ASSERT(zeros);
+        TEST_ASSERT(UnitTest::matches(data.operator char *(), 100, 1));
+        TEST_ASSERT(UnitTest::matches(data.operator char *()+20000, 10, 2));
+        
+        Memory other = store.readFromFile(after, 0, 5000);
+        TEST_ASSERT(other.length() == 5000 && UnitTest::matches(other.operator char *(), 5000, 3));
+    }
+
+    void testWriteAheadLog(UnitTest &test) {
+        test.run("wal: nested rollback", testNestedRollback);
+        test.run("wal: failed setMany in a batch", testFailedSetManyInBatch);
+        test.run("wal: replay after a crash", testReplayAfterCrash);
+        test.run("wal: replay of reserved space", testReplayReservedSpace);
+    }
+
+}
@@ -6,22 +6,31 @@
 //  Copyright © 2018 Liquidsoft Studio. All rights reserved.
 //
 
-#include <iostream>
-#include "../libnrio/IndexedDataStore.h"
-
-#include <libnrcore/memory/ByteArray.h>
+#include "UnitTest.h"
 
 using namespace nrcore;
 
 int main(int argc, const char * argv[]) {
-    IndexedDataStore *data = new IndexedDataStore("/media/mint/9d008129-b444-490f-a90d-d3fc4a808f93/output/state.dat");
-    
     try {
-        Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file1 = data->getFile(Memory("block", 5));
-        unsigned long long flen = data->getFileSize(file1);
-        printf("-> %llu\n", flen);
+        UnitTest test;
+        
+        testWriteAheadLog(test);
+        testFormat(test);
+        testConcurrency(test);
+        testCursor(test);
+        testFile(test);
+        testCodec(test);
+        testSparseFiles(test);
+        testParallelRead(test);
+        testValues(test);
+        
+        if (test.getFailures()) {
+            fprintf(stderr, "%d failed\n", test.getFailures());
+            return 1;
+        }
     } catch (const char * e) {
-        printf("%s\n", e);
+        fprintf(stderr, "%s\n", e);
+        return 1;
     }
 
     return 0;
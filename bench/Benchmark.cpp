@@ -0,0 +1,91 @@
+//
+//  Benchmark.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "Benchmark.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+namespace nrcore {
+
+    Benchmark::Benchmark() : state(BENCH_SEED) {
+        const char *tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/nrio-bench.XXXXXX";
+        
+        std::vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back(0);
+        if (!mkdtemp(&buf[0]))
+            throw "Failed to create benchmark directory";
+        
+        dir = &buf[0];
+    }
+
+    Benchmark::~Benchmark() {
+        reset();
+        rmdir(dir.c_str());
+    }
+
+    std::string Benchmark::path(const char *name) {
+        std::string ret = dir + "/" + name;
+        files.push_back(ret);
+        files.push_back(ret + ".wal");
+        return ret;
+    }
+
+    void Benchmark::reset() {
+        for (size_t i=0; i<files.size(); i++)
+            unlink(files[i].c_str());
+        files.clear();
+    }
+
+    void Benchmark::begin() {
+        clock_gettime(CLOCK_MONOTONIC, &started);
+    }
+
+    void Benchmark::end(const char *suite, const char *name, const std::string &params, unsigned long long ops, unsigned long long bytes) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        
+        RESULT result;
+        result.suite = suite;
+        result.name = name;
+        result.params = params;
+        result.ops = ops;
+        result.bytes = bytes;
+        result.seconds = (now.tv_sec-started.tv_sec) + (now.tv_nsec-started.tv_nsec)/1e9;
+        results.push_back(result);
+        
+        fprintf(stderr, "%s/%s {%s}: %llu ops in %.3fs\n", suite, name, params.c_str(), ops, result.seconds);
+    }
+
+    unsigned long long Benchmark::random() {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    void Benchmark::write(FILE *out) {
+        fprintf(out, "{\n  \"seed\": %llu,\n  \"results\": [\n", BENCH_SEED);
+        
+        for (size_t i=0; i<results.size(); i++) {
+            RESULT *r = &results[i];
+            double ops_per_second = r->seconds > 0 ? r->ops/r->seconds : 0;
+            double mb_per_second = r->seconds > 0 ? r->bytes/r->seconds/(1024*1024) : 0;
+            
+            fprintf(out, "    {\"suite\": \"%s\", \"name\": \"%s\", \"params\": {%s}, \"ops\": %llu, \"bytes\": %llu, "
+                    "\"seconds\": %.6f, \"ops_per_second\": %.1f, \"mb_per_second\": %.2f}%s\n",
+                    r->suite.c_str(), r->name.c_str(), r->params.c_str(), r->ops, r->bytes,
+                    r->seconds, ops_per_second, mb_per_second, i+1 < results.size() ? "," : "");
+        }
+        
+        fprintf(out, "  ]\n}\n");
+    }
+
+}
@@ -0,0 +1,58 @@
+//
+//  Benchmark.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef Benchmark_hpp
+#define Benchmark_hpp
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#define BENCH_SEED 0x9E3779B97F4A7C15ULL
+
+namespace nrcore {
+
+    // Times benchmark runs against files in a private temporary directory and reports them as JSON.
+    // Every run uses the same pseudo random sequence so results can be compared between builds.
+    class Benchmark {
+    public:
+        Benchmark();
+        virtual ~Benchmark(); // Removes the temporary directory and everything created through path()
+        
+        std::string path(const char *name);
+        void reset(); // Removes the files created so far
+        
+        void begin();
+        void end(const char *suite, const char *name, const std::string &params, unsigned long long ops, unsigned long long bytes);
+        
+        unsigned long long random();
+        
+        void write(FILE *out);
+        
+    private:
+        typedef struct {
+            std::string suite;
+            std::string name;
+            std::string params;
+            unsigned long long ops;
+            unsigned long long bytes;
+            double seconds;
+        } RESULT;
+        
+        std::string dir;
+        std::vector<std::string> files;
+        std::vector<RESULT> results;
+        struct timespec started;
+        unsigned long long state;
+    };
+
+}
+
+#endif /* Benchmark_hpp */
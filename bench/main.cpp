@@ -0,0 +1,243 @@
+//
+//  main.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Benchmark.h"
+#include "../libnrio/IndexedDataStore.h"
+#include "../libnrio/File.h"
+#include "../libnrio/FileStream.h"
+#include "../libnrio/TextStream.h"
+#include "../libnrio/StringStreamReader.h"
+
+using namespace nrcore;
+
+static std::string params(const char *format, unsigned long long a, unsigned long long b=0) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), format, a, b);
+    return buf;
+}
+
+static Memory keyFor(char *buf, unsigned long long index) {
+    int len = snprintf(buf, 32, "bench/key/%08llu", index);
+    return Memory(buf, len);
+}
+
+static void benchStoreKeys(Benchmark &bench, unsigned long long keys, unsigned int value_size) {
+    std::string p = params("\"keys\": %llu, \"value_size\": %llu", keys, value_size);
+    IndexedDataStore store(bench.path("keys.dat").c_str());
+    Memory value(value_size);
+    memset(value.operator char *(), 'v', value_size);
+    char key[32];
+    
+    bench.begin();
+    for (unsigned long long i=0; i<keys; i++)
+        store.set(keyFor(key, i), value);
+    bench.end("store", "set", p, keys, keys*value_size);
+    
+    bench.begin();
+    for (unsigned long long i=0; i<keys; i++)
+        store.set(keyFor(key, bench.random()%keys), value);
+    bench.end("store", "overwrite", p, keys, keys*value_size);
+    
+    bench.begin();
+    for (unsigned long long i=0; i<keys; i++)
+        store.read(keyFor(key, bench.random()%keys), value_size);
+    bench.end("store", "get", p, keys, keys*value_size);
+    
+    bench.begin();
+    for (unsigned long long i=0; i<keys; i++)
+        store.tryGetFile(keyFor(key, keys+i));
+    bench.end("store", "get_missing", p, keys, 0);
+    
+    bench.reset();
+}
+
+static void benchStoreFile(Benchmark &bench, unsigned int block_size, unsigned long long size, unsigned int chunk, unsigned long long reads) {
+    size -= size%chunk;
+    std::string p = params("\"block_size\": %llu, \"chunk\": %llu", block_size, chunk);
+    IndexedDataStore store(bench.path("file.dat").c_str());
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> file = store.createFile(Memory("bench/file", 10), block_size);
+    Memory data(chunk);
+    memset(data.operator char *(), 'd', chunk);
+    
+    bench.begin();
+    for (unsigned long long offset=0; offset<size; offset+=chunk)
+        store.writeToFile(file, data, offset, chunk);
+    bench.end("store", "append", p, size/chunk, size);
+    
+    bench.begin();
+    for (unsigned long long i=0; i<reads; i++)
+        store.readFromFile(file, bench.random()%(size-chunk), data.operator char *(), chunk);
+    bench.end("store", "random_read", p, reads, reads*chunk);
+    
+    bench.begin();
+    store.readFromFile(file, 0, size);
+    bench.end("store", "sequential_read", p, 1, size);
+    
+    bench.reset();
+}
+
+static void benchFile(Benchmark &bench, bool mapped, unsigned long long size, unsigned int chunk, unsigned long long reads) {
+    size -= size%chunk;
+    std::string p = params("\"mapped\": %llu, \"chunk\": %llu", mapped, chunk);
+    std::string path = bench.path("raw.dat");
+    Memory data(chunk);
+    memset(data.operator char *(), 'f', chunk);
+    
+    {
+        File file(path.c_str(), mapped);
+        
+        bench.begin();
+        for (unsigned long long offset=0; offset<size; offset+=chunk)
+            file.write(offset, data.operator char *(), chunk);
+        file.sync();
+        bench.end("file", "write", p, size/chunk, size);
+        
+        bench.begin();
+        for (unsigned long long i=0; i<reads; i++)
+            file.read(bench.random()%(size-chunk), data.operator char *(), chunk);
+        bench.end("file", "random_read", p, reads, reads*chunk);
+    }
+    
+    bench.reset();
+}
+
+static void benchStream(Benchmark &bench, unsigned long long size, unsigned int chunk) {
+    size -= size%chunk;
+    std::string p = params("\"chunk\": %llu", chunk);
+    std::string path = bench.path("stream.dat");
+    Memory data(chunk);
+    memset(data.operator char *(), 's', chunk);
+    
+    {
+        FileStream stream(String(path.c_str()));
+        bench.begin();
+        for (unsigned long long offset=0; offset<size; offset+=chunk)
+            stream.write(data.operator char *(), chunk);
+        stream.flush();
+        bench.end("filestream", "write", p, size/chunk, size);
+        stream.close();
+    }
+    
+    {
+        FileStream stream(String(path.c_str()));
+        bench.begin();
+        unsigned long long ops = 0;
+        while (stream.read(data.operator char *(), chunk) > 0)
+            ops++;
+        bench.end("filestream", "read", p, ops, ops*chunk);
+        stream.close();
+    }
+    
+    {
+        Stream stream(open(path.c_str(), O_RDONLY));
+        bench.begin();
+        unsigned long long ops = 0, bytes = 0;
+        ssize_t len;
+        while ((len = stream.read(data.operator char *(), chunk)) > 0) {
+            ops++;
+            bytes += len;
+        }
+        bench.end("stream", "read", p, ops, bytes);
+    }
+    
+    bench.reset();
+}
+
+class LineCounter : public StringStreamReader {
+public:
+    LineCounter(Stream *stream) : StringStreamReader(stream), lines(0), bytes(0) {}
+    
+    unsigned long long lines;
+    unsigned long long bytes;
+    
+protected:
+    void onLineRead(const char *line) {
+        lines++;
+        bytes += strlen(line)+1;
+    }
+};
+
+static void benchText(Benchmark &bench, unsigned long long lines) {
+    std::string p = params("\"lines\": %llu", lines);
+    std::string path = bench.path("lines.txt");
+    String line("timestamp=1700000000 sensor=42 temperature=21.5 humidity=40 status=ok");
+    unsigned long long bytes = lines*(line.length()+1);
+    
+    {
+        TextStream stream(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+        bench.begin();
+        for (unsigned long long i=0; i<lines; i++)
+            stream.writeLine(line);
+        bench.end("textstream", "write_line", p, lines, bytes);
+    }
+    
+    {
+        TextStream stream(open(path.c_str(), O_RDONLY));
+        bench.begin();
+        for (unsigned long long i=0; i<lines; i++)
+            stream.readLine();
+        bench.end("textstream", "read_line", p, lines, bytes);
+    }
+    
+    {
+        Stream stream(open(path.c_str(), O_RDONLY));
+        LineCounter reader(&stream);
+        bench.begin();
+        reader.runBlockingMode();
+        bench.end("stringstreamreader", "read_line", p, reader.lines, bytes);
+    }
+    
+    bench.reset();
+}
+
+int main(int argc, const char * argv[]) {
+    // -q runs every benchmark at a tenth of the size, for checking the suite itself
+    bool quick = argc > 1 && !strcmp(argv[1], "-q");
+    const char *output = argc > (quick ? 2 : 1) ? argv[quick ? 2 : 1] : 0;
+    unsigned long long scale = quick ? 10 : 1;
+    
+    try {
+        Benchmark bench;
+        
+        unsigned long long key_counts[] = {1000, 10000, 100000};
+        for (int i=0; i<3; i++) {
+            benchStoreKeys(bench, key_counts[i]/scale, 8);
+            benchStoreKeys(bench, key_counts[i]/scale, 256);
+        }
+        
+        unsigned int block_sizes[] = {512, 4096, 65536};
+        for (int i=0; i<3; i++)
+            benchStoreFile(bench, block_sizes[i], 64*1024*1024/scale, 4096, 100000/scale);
+        
+        benchFile(bench, false, 64*1024*1024/scale, 4096, 100000/scale);
+        benchFile(bench, true, 64*1024*1024/scale, 4096, 100000/scale);
+        
+        benchStream(bench, 64*1024*1024/scale, 4096);
+        benchStream(bench, 64*1024*1024/scale, 65536);
+        
+        // Stream writes are synced one at a time, so this is kept smaller than the other suites
+        benchText(bench, 50000/scale);
+        
+        FILE *out = output ? fopen(output, "w") : stdout;
+        if (!out)
+            throw "Failed to open output";
+        bench.write(out);
+        if (output)
+            fclose(out);
+    } catch (const char * e) {
+        fprintf(stderr, "%s\n", e);
+        return 1;
+    }
+    
+    return 0;
+}
@@ -7,5 +7,6 @@
 #define DEBUG_DISABLED		0
 #define ENCRYPTION_DISABLED	0
 #define IO_DISABLED		0
+#define STATS_DISABLED		0
 
 #endif//__CONFIG_H__
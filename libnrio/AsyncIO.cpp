@@ -0,0 +1,194 @@
+//
+//  AsyncIO.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "AsyncIO.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+namespace nrcore {
+
+    // Locks the queue for the rest of the enclosing scope
+    class QueueLock {
+    public:
+        QueueLock(pthread_mutex_t *mutex) : mutex(mutex) {
+            pthread_mutex_lock(mutex);
+        }
+        
+        ~QueueLock() {
+            pthread_mutex_unlock(mutex);
+        }
+        
+    private:
+        pthread_mutex_t *mutex;
+    };
+
+    AsyncIO::AsyncIO(int threads) : stopping(false) {
+        pthread_mutex_init(&mutex, 0);
+        pthread_cond_init(&queued, 0);
+        pthread_cond_init(&completed, 0);
+        
+        if (threads < 1)
+            threads = 1;
+        
+        for (int i=0; i<threads; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, 0, worker, this) == 0)
+                this->threads.push_back(thread);
+        }
+        
+        if (!this->threads.size())
+            throw "Failed to start io threads";
+    }
+
+    AsyncIO::~AsyncIO() {
+        {
+            QueueLock lock(&mutex);
+            stopping = true;
+            pthread_cond_broadcast(&queued);
+        }
+        
+        for (size_t i=0; i<threads.size(); i++)
+            pthread_join(threads[i], 0);
+        
+        pthread_cond_destroy(&completed);
+        pthread_cond_destroy(&queued);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void AsyncIO::prepare(IO_REQUEST *request, int fd, int op, long long offset, char *buffer, size_t length, Callback callback, void *context) {
+        request->fd = fd;
+        request->op = op;
+        request->offset = offset;
+        request->buffer = buffer;
+        request->length = length;
+        request->callback = callback;
+        request->context = context;
+        request->result = 0;
+        request->error = 0;
+        request->done = false;
+    }
+
+    void AsyncIO::submit(IO_REQUEST *request) {
+        QueueLock lock(&mutex);
+        request->done = false;
+        queue.push_back(request);
+        pthread_cond_signal(&queued);
+    }
+
+    void AsyncIO::submit(IO_REQUEST *requests, size_t count) {
+        if (!count)
+            return;
+        
+        QueueLock lock(&mutex);
+        for (size_t i=0; i<count; i++) {
+            requests[i].done = false;
+            queue.push_back(&requests[i]);
+        }
+        pthread_cond_broadcast(&queued);
+    }
+
+    bool AsyncIO::isDone(IO_REQUEST *request) {
+        QueueLock lock(&mutex);
+        return request->done;
+    }
+
+    ssize_t AsyncIO::wait(IO_REQUEST *request) {
+        QueueLock lock(&mutex);
+        while (!request->done)
+            pthread_cond_wait(&completed, &mutex);
+        
+        return request->result;
+    }
+
+    void AsyncIO::wait(IO_REQUEST *requests, size_t count) {
+        QueueLock lock(&mutex);
+        for (size_t i=0; i<count; i++) {
+            while (!requests[i].done)
+                pthread_cond_wait(&completed, &mutex);
+        }
+    }
+
+    AsyncIO& AsyncIO::getShared() {
+        static AsyncIO shared;
+        return shared;
+    }
+
+    void* AsyncIO::worker(void *arg) {
+        ((AsyncIO*)arg)->run();
+        return 0;
+    }
+
+    void AsyncIO::run() {
+        while (true) {
+            IO_REQUEST *request;
+            {
+                QueueLock lock(&mutex);
+                while (!queue.size() && !stopping)
+                    pthread_cond_wait(&queued, &mutex);
+                
+                // Whatever was queued before the destructor ran is still completed
+                if (!queue.size())
+                    return;
+                
+                request = queue.front();
+                queue.pop_front();
+            }
+            
+            perform(request);
+            if (request->callback)
+                request->callback(request, request->context);
+            
+            QueueLock lock(&mutex);
+            request->done = true;
+            pthread_cond_broadcast(&completed);
+        }
+    }
+
+    void AsyncIO::perform(IO_REQUEST *request) {
+        // Short transfers are continued until the whole length is done or the descriptor runs out
+        size_t done = 0;
+        while (done < request->length) {
+            ssize_t len;
+            char *buffer = request->buffer+done;
+            size_t remaining = request->length-done;
+            
+            if (request->op & ASYNC_IO_WRITE) {
+                if (request->offset < 0)
+                    len = ::write(request->fd, buffer, remaining);
+                else
+                    len = pwrite(request->fd, buffer, remaining, (off_t)(request->offset+done));
+            } else {
+                if (request->offset < 0)
+                    len = ::read(request->fd, buffer, remaining);
+                else
+                    len = pread(request->fd, buffer, remaining, (off_t)(request->offset+done));
+            }
+            
+            if (len < 0 && errno == EINTR)
+                continue;
+            
+            if (len < 0) {
+                request->error = errno;
+                request->result = done ? (ssize_t)done : -1;
+                return;
+            }
+            
+            if (len == 0)
+                break;
+            
+            done += len;
+        }
+        
+        if ((request->op & ASYNC_IO_WRITE) && (request->op & ASYNC_IO_SYNC) && fsync(request->fd) != 0)
+            request->error = errno;
+        
+        request->result = (ssize_t)done;
+    }
+
+}
@@ -0,0 +1,81 @@
+//
+//  AsyncIO.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef AsyncIO_hpp
+#define AsyncIO_hpp
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <vector>
+
+#define ASYNC_IO_THREADS        4
+
+#define ASYNC_IO_READ           0x1
+#define ASYNC_IO_WRITE          0x2
+#define ASYNC_IO_SYNC           0x4     // fsync once a write has completed
+
+namespace nrcore {
+
+    // Queue of reads and writes completed by a small pool of worker threads, so one caller can keep many requests
+    // in flight instead of blocking on each. Requests are owned by the caller and must stay valid until they are done.
+    class AsyncIO {
+    public:
+        struct IO_REQUEST;
+        
+        // Called on a worker thread once the request has completed, it must not free the request
+        typedef void (*Callback)(struct IO_REQUEST *request, void *context);
+        
+        typedef struct IO_REQUEST {
+            int fd;
+            int op;
+            long long offset;       // -1 to read or write at the descriptor's own position
+            char *buffer;
+            size_t length;
+            Callback callback;
+            void *context;
+            
+            ssize_t result;         // Bytes transferred, -1 on error
+            int error;
+            bool done;
+        } IO_REQUEST;
+        
+        AsyncIO(int threads=ASYNC_IO_THREADS);
+        virtual ~AsyncIO(); // Completes everything queued before returning
+        
+        static void prepare(IO_REQUEST *request, int fd, int op, long long offset, char *buffer, size_t length, Callback callback=0, void *context=0);
+        
+        void submit(IO_REQUEST *request);
+        void submit(IO_REQUEST *requests, size_t count); // Queued under one lock and one wake up
+        
+        bool isDone(IO_REQUEST *request);
+        ssize_t wait(IO_REQUEST *request);
+        void wait(IO_REQUEST *requests, size_t count);
+        
+        static AsyncIO& getShared();
+        
+    private:
+        pthread_mutex_t mutex;
+        pthread_cond_t queued;
+        pthread_cond_t completed;
+        
+        std::deque<IO_REQUEST*> queue;
+        std::vector<pthread_t> threads;
+        bool stopping;
+        
+        static void* worker(void *arg);
+        void run();
+        
+        static void perform(IO_REQUEST *request);
+    };
+
+}
+
+#endif /* AsyncIO_hpp */
@@ -0,0 +1,178 @@
+//
+//  BlockCodec.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "BlockCodec.h"
+
+#include <string.h>
+
+namespace nrcore {
+
+    static inline unsigned int read32(const unsigned char *p) {
+        unsigned int v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static inline unsigned int hash32(unsigned int v) {
+        return (v*2654435761U) >> (32-CODEC_HASH_BITS);
+    }
+
+    size_t BlockCodec::compress(const char *src, size_t length, char *dst, size_t capacity) {
+        const unsigned char *in = (const unsigned char*)src;
+        const unsigned char *end = in+length;
+        const unsigned char *anchor = in;
+        const unsigned char *ip = in;
+        unsigned char *op = (unsigned char*)dst;
+        unsigned char *op_end = op+capacity;
+        
+        // Positions are stored off by one so a zeroed table means no candidate
+        unsigned int table[1 << CODEC_HASH_BITS];
+        memset(table, 0, sizeof(table));
+        
+        while (length >= CODEC_MIN_MATCH+CODEC_LAST_LITERALS && ip <= end-CODEC_MIN_MATCH-CODEC_LAST_LITERALS) {
+            unsigned int seq = read32(ip);
+            unsigned int h = hash32(seq);
+            const unsigned char *ref = in+table[h]-1;
+            bool found = table[h] && (size_t)(ip-ref) <= CODEC_MAX_DISTANCE && read32(ref) == seq;
+            table[h] = (unsigned int)(ip-in)+1;
+            
+            if (!found) {
+                ip++;
+                continue;
+            }
+            
+            const unsigned char *match_end = ip+CODEC_MIN_MATCH;
+            ref += CODEC_MIN_MATCH;
+            while (match_end < end-CODEC_LAST_LITERALS && *match_end == *ref) {
+                match_end++;
+                ref++;
+            }
+            
+            size_t literals = ip-anchor;
+            size_t match = match_end-ip-CODEC_MIN_MATCH;
+            
+            if (op >= op_end)
+                return 0;
+            unsigned char *token = op++;
+            *token = (unsigned char)(((literals < 15 ? literals : 15) << 4) | (match < 15 ? match : 15));
+            
+            if (literals >= 15 && !(op = writeLength(op, op_end, literals-15)))
+                return 0;
+            if (op+literals+2 > op_end)
+                return 0;
+            memcpy(op, anchor, literals);
+            op += literals;
+            
+            size_t distance = match_end-ref;
+            *op++ = (unsigned char)(distance & 0xFF);
+            *op++ = (unsigned char)(distance >> 8);
+            
+            if (match >= 15 && !(op = writeLength(op, op_end, match-15)))
+                return 0;
+            
+            ip = match_end;
+            anchor = ip;
+        }
+        
+        // The last sequence only carries literals
+        size_t literals = end-anchor;
+        if (op >= op_end)
+            return 0;
+        *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15 && !(op = writeLength(op, op_end, literals-15)))
+            return 0;
+        if (op+literals > op_end)
+            return 0;
+        memcpy(op, anchor, literals);
+        op += literals;
+        
+        return op-(unsigned char*)dst;
+    }
+
+    bool BlockCodec::decompress(const char *src, size_t src_length, char *dst, size_t length) {
+        const unsigned char *ip = (const unsigned char*)src;
+        const unsigned char *ip_end = ip+src_length;
+        unsigned char *out = (unsigned char*)dst;
+        unsigned char *op = out;
+        unsigned char *op_end = out+length;
+        
+        while (ip < ip_end) {
+            unsigned int token = *ip++;
+            
+            size_t literals = token >> 4;
+            if (literals == 15) {
+                unsigned char b;
+                do {
+                    if (ip >= ip_end)
+                        return false;
+                    b = *ip++;
+                    literals += b;
+                } while (b == 255);
+            }
+            
+            if (literals > (size_t)(ip_end-ip) || literals > (size_t)(op_end-op))
+                return false;
+            memcpy(op, ip, literals);
+            ip += literals;
+            op += literals;
+            
+            if (op == op_end)
+                return true;
+            
+            if (ip_end-ip < 2)
+                return false;
+            size_t distance = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (!distance || distance > (size_t)(op-out))
+                return false;
+            
+            size_t match = token & 15;
+            if (match == 15) {
+                unsigned char b;
+                do {
+                    if (ip >= ip_end)
+                        return false;
+                    b = *ip++;
+                    match += b;
+                } while (b == 255);
+            }
+            match += CODEC_MIN_MATCH;
+            
+            if (match > (size_t)(op_end-op))
+                return false;
+            
+            // Overlapping matches repeat the bytes just written, so they are copied forwards one at a time
+            const unsigned char *ref = op-distance;
+            if (distance >= match) {
+                memcpy(op, ref, match);
+                op += match;
+            } else {
+                while (match--)
+                    *op++ = *ref++;
+            }
+        }
+        
+        return op == op_end;
+    }
+
+    unsigned char *BlockCodec::writeLength(unsigned char *out, const unsigned char *end, size_t length) {
+        while (length >= 255) {
+            if (out >= end)
+                return 0;
+            *out++ = 255;
+            length -= 255;
+        }
+        
+        if (out >= end)
+            return 0;
+        *out++ = (unsigned char)length;
+        
+        return out;
+    }
+
+}
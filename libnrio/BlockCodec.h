@@ -0,0 +1,38 @@
+//
+//  BlockCodec.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef BlockCodec_hpp
+#define BlockCodec_hpp
+
+#include <stddef.h>
+
+#define CODEC_HASH_BITS 12
+#define CODEC_MIN_MATCH 4
+#define CODEC_LAST_LITERALS 5           // Matches stop this far from the end so every block ends in literals
+#define CODEC_MAX_DISTANCE 65535
+
+namespace nrcore {
+
+    // Byte oriented LZ77 codec for data blocks. Each sequence is a token holding the literal and match lengths,
+    // the literals, then a 16 bit match distance. There is no stream header, the decoder stops once the expected
+    // number of bytes has been produced so anything stored after the stream is ignored.
+    class BlockCodec {
+    public:
+        // Returns the compressed length, or 0 when the output does not fit in capacity
+        static size_t compress(const char *src, size_t length, char *dst, size_t capacity);
+        
+        // Produces exactly length bytes, returns false when the stream is malformed
+        static bool decompress(const char *src, size_t src_length, char *dst, size_t length);
+        
+    private:
+        static unsigned char *writeLength(unsigned char *out, const unsigned char *end, size_t length);
+    };
+
+}
+
+#endif /* BlockCodec_hpp */
@@ -0,0 +1,85 @@
+//
+//  BloomFilter.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "BloomFilter.h"
+
+namespace nrcore {
+
+    BloomFilter::BloomFilter() : mask(0), keys(0), max_keys(0) {
+        reset(0);
+    }
+
+    BloomFilter::~BloomFilter() {
+    }
+
+    void BloomFilter::reset(size_t keys) {
+        if (keys < BLOOM_MIN_KEYS)
+            keys = BLOOM_MIN_KEYS;
+        
+        // A power of two number of bits so probes are masked rather than divided
+        unsigned long long size = 64;
+        while (size < (unsigned long long)keys*BLOOM_BITS_PER_KEY)
+            size <<= 1;
+        
+        bits.assign((size_t)(size/64), 0);
+        mask = size-1;
+        max_keys = (size_t)(size/BLOOM_BITS_PER_KEY);
+        this->keys = 0;
+    }
+
+    void BloomFilter::add(const char *key, size_t length) {
+        unsigned long long h = hash(key, length);
+        unsigned long long step = (h >> 32) | 1;
+        
+        for (int i=0; i<BLOOM_HASHES; i++) {
+            unsigned long long bit = (h+i*step) & mask;
+            bits[bit >> 6] |= 1ULL << (bit & 63);
+        }
+        
+        keys++;
+    }
+
+    bool BloomFilter::mayContain(const char *key, size_t length) const {
+        unsigned long long h = hash(key, length);
+        unsigned long long step = (h >> 32) | 1;
+        
+        for (int i=0; i<BLOOM_HASHES; i++) {
+            unsigned long long bit = (h+i*step) & mask;
+            if (!(bits[bit >> 6] & (1ULL << (bit & 63))))
+                return false;
+        }
+        
+        return true;
+    }
+
+    size_t BloomFilter::size() const {
+        return keys;
+    }
+
+    size_t BloomFilter::capacity() const {
+        return max_keys;
+    }
+
+    unsigned long long BloomFilter::hash(const char *key, size_t length) {
+        // FNV-1a followed by a 64 bit finaliser so both halves are usable as independent hashes
+        unsigned long long h = 14695981039346656037ULL;
+        for (size_t i=0; i<length; i++) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        
+        return h;
+    }
+
+}
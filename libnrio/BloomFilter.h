@@ -0,0 +1,48 @@
+//
+//  BloomFilter.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef BloomFilter_hpp
+#define BloomFilter_hpp
+
+#include <stddef.h>
+
+#include <vector>
+
+#define BLOOM_BITS_PER_KEY 10   // About 1% false positives
+#define BLOOM_HASHES 7
+#define BLOOM_MIN_KEYS 4096
+
+namespace nrcore {
+
+    // In memory set membership test, answers either "definitely absent" or "possibly present".
+    // Keys cannot be removed, the filter is rebuilt from scratch when it outgrows its capacity.
+    class BloomFilter {
+    public:
+        BloomFilter();
+        virtual ~BloomFilter();
+        
+        void reset(size_t keys); // Empties the filter and sizes it for at least keys entries
+        
+        void add(const char *key, size_t length);
+        bool mayContain(const char *key, size_t length) const;
+        
+        size_t size() const;     // Keys added since the last reset
+        size_t capacity() const; // Keys that fit before false positives exceed the target rate
+        
+    private:
+        std::vector<unsigned long long> bits;
+        unsigned long long mask;
+        size_t keys;
+        size_t max_keys;
+        
+        static unsigned long long hash(const char *key, size_t length);
+    };
+
+}
+
+#endif /* BloomFilter_hpp */
@@ -0,0 +1,141 @@
+//
+//  DescriptorCache.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "DescriptorCache.h"
+
+#include <string.h>
+
+namespace nrcore {
+
+    // Locks the cache for the rest of the enclosing scope
+    class CacheLock {
+    public:
+        CacheLock(pthread_mutex_t *mutex) : mutex(mutex) {
+            pthread_mutex_lock(mutex);
+        }
+        
+        ~CacheLock() {
+            pthread_mutex_unlock(mutex);
+        }
+        
+    private:
+        pthread_mutex_t *mutex;
+    };
+
+    DescriptorCache::DescriptorCache(size_t capacity) : capacity(capacity), hits(0), misses(0) {
+        pthread_mutex_init(&mutex, 0);
+    }
+
+    DescriptorCache::~DescriptorCache() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    bool DescriptorCache::get(unsigned long long offset, void *descriptor, size_t length) {
+        CacheLock lock(&mutex);
+        std::unordered_map<unsigned long long, EntryList::iterator>::iterator it = lookup.find(offset);
+        
+        // A shorter read is served from the start of a longer entry, such as a file descriptor read out of its value record
+        if (it == lookup.end() || it->second->descriptor.length() < length) {
+            misses++;
+            return false;
+        }
+        
+        entries.splice(entries.begin(), entries, it->second);
+        memcpy(descriptor, it->second->descriptor.operator char *(), length);
+        hits++;
+        
+        return true;
+    }
+
+    void DescriptorCache::put(unsigned long long offset, const void *descriptor, size_t length) {
+        CacheLock lock(&mutex);
+        if (!capacity)
+            return;
+        
+        std::unordered_map<unsigned long long, EntryList::iterator>::iterator it = lookup.find(offset);
+        if (it != lookup.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            if (it->second->descriptor.length() != length)
+                it->second->descriptor = Memory(length);
+            memcpy(it->second->descriptor.operator char *(), descriptor, length);
+            return;
+        }
+        
+        if (lookup.size() >= capacity) {
+            // Recycle the least recently used entry rather than allocating a new one
+            EntryList::iterator last = --entries.end();
+            lookup.erase(last->offset);
+            entries.splice(entries.begin(), entries, last);
+            
+            if (entries.front().descriptor.length() != length)
+                entries.front().descriptor = Memory(length);
+        } else {
+            ENTRY entry = {offset, Memory(length)};
+            entries.push_front(entry);
+        }
+        
+        entries.front().offset = offset;
+        memcpy(entries.front().descriptor.operator char *(), descriptor, length);
+        lookup[offset] = entries.begin();
+    }
+
+    void DescriptorCache::invalidate(unsigned long long offset) {
+        CacheLock lock(&mutex);
+        std::unordered_map<unsigned long long, EntryList::iterator>::iterator it = lookup.find(offset);
+        if (it != lookup.end()) {
+            entries.erase(it->second);
+            lookup.erase(it);
+        }
+    }
+
+    void DescriptorCache::clear() {
+        CacheLock lock(&mutex);
+        entries.clear();
+        lookup.clear();
+    }
+
+    void DescriptorCache::setCapacity(size_t capacity) {
+        CacheLock lock(&mutex);
+        this->capacity = capacity;
+        evict();
+    }
+
+    size_t DescriptorCache::getCapacity() {
+        CacheLock lock(&mutex);
+        return capacity;
+    }
+
+    size_t DescriptorCache::size() {
+        CacheLock lock(&mutex);
+        return lookup.size();
+    }
+
+    unsigned long long DescriptorCache::getHits() {
+        CacheLock lock(&mutex);
+        return hits;
+    }
+
+    unsigned long long DescriptorCache::getMisses() {
+        CacheLock lock(&mutex);
+        return misses;
+    }
+
+    void DescriptorCache::resetCounters() {
+        CacheLock lock(&mutex);
+        hits = 0;
+        misses = 0;
+    }
+
+    void DescriptorCache::evict() {
+        while (lookup.size() > capacity) {
+            lookup.erase(entries.back().offset);
+            entries.pop_back();
+        }
+    }
+
+}
@@ -0,0 +1,66 @@
+//
+//  DescriptorCache.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef DescriptorCache_hpp
+#define DescriptorCache_hpp
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include <list>
+#include <unordered_map>
+
+#include <libnrcore/memory/Memory.h>
+
+#define DESCRIPTOR_CACHE_SIZE 4096
+
+namespace nrcore {
+
+    // Least recently used cache of on disk descriptors keyed by their file offset.
+    // Descriptors are stored by value, callers always receive a private copy. Safe to share between threads.
+    class DescriptorCache {
+    public:
+        DescriptorCache(size_t capacity);
+        virtual ~DescriptorCache();
+        
+        bool get(unsigned long long offset, void *descriptor, size_t length);
+        void put(unsigned long long offset, const void *descriptor, size_t length);
+        void invalidate(unsigned long long offset);
+        void clear();
+        
+        void setCapacity(size_t capacity);
+        size_t getCapacity();
+        size_t size();
+        
+        unsigned long long getHits();
+        unsigned long long getMisses();
+        void resetCounters();
+        
+    private:
+        typedef struct {
+            unsigned long long offset;
+            Memory descriptor;
+        } ENTRY;
+        
+        typedef std::list<ENTRY> EntryList;
+        
+        pthread_mutex_t mutex;
+        
+        size_t capacity;
+        unsigned long long hits;
+        unsigned long long misses;
+        
+        EntryList entries;  // Most recently used first
+        std::unordered_map<unsigned long long, EntryList::iterator> lookup;
+        
+        void evict();
+    };
+
+}
+
+#endif /* DescriptorCache_hpp */
@@ -8,9 +8,12 @@
 
 #include "File.h"
 
+#include <unistd.h>
+#include <sys/mman.h>
+
 namespace nrcore {
 
-    File::File(const char *path) : Memory(FILE_BUFFER_SIZE), fill(0), offset(0), update_file(false)  {
+    File::File(const char *path, bool mapped) : Memory(FILE_BUFFER_SIZE), fill(0), offset(0), update_file(false), mapped(mapped), map(0), map_size(0), file_size(0)  {
         this->path = path;
         
         fp = fopen(path, "r+");
@@ -22,6 +25,12 @@ namespace nrcore {
         
         updateFileSize();
         
+        if (mapped) {
+            file_size = sz;
+            remap(sz);
+            return;
+        }
+        
         fill = fread(buffer.getPtr(), 1, FILE_BUFFER_SIZE, fp);
     }
     
@@ -29,14 +38,24 @@ namespace nrcore {
         if (update_file)
             updateFile();
         
-        if (fp)
+        if (map) {
+            msync(map, sz, MS_SYNC);
+            munmap(map, map_size);
+        }
+        
+        if (fp) {
+            trim();
             fclose(fp);
+        }
     }
     
     char& File::operator [](size_t index) {
         if (index>=sz)
             throw "Index Out Of Range";
         
+        if (mapped)
+            return map[index];
+        
         if (fill && index >= offset && index < offset+fill)
             return Memory::operator [](index-offset);
         
@@ -44,6 +63,7 @@ namespace nrcore {
             updateFile();
         
         offset = index-(index%FILE_BUFFER_SIZE);
+        STATS_COUNT(stats.fseeks, 1);
         fseek(fp, offset, SEEK_SET);
         fill = fread(buffer.getPtr(), 1, FILE_BUFFER_SIZE, fp);
         return Memory::operator [](index-offset);
@@ -51,9 +71,15 @@ namespace nrcore {
     
     
     Memory File::getMemory() const {
+        if (mapped)
+            return Memory(map, sz);
+        
+        STATS_TIME(stats.read_latency);
         char *buf = new char[sz];
-        fseek(fp, 0L, SEEK_SET);
-        size_t len = fread(buf, 1, sz, fp);
+        size_t len = readAt(0, buf, sz);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, sz);
+        STATS_COUNT(stats.bytes_read, len);
         
         Memory mem(buf, len);
         
@@ -63,9 +89,15 @@ namespace nrcore {
     }
     
     Memory File::getSubBytes(size_t offset, size_t length) const {
+        if (mapped)
+            return read(offset, length);
+        
+        STATS_TIME(stats.read_latency);
         char *buf = new char[length];
-        fseek(fp, offset, SEEK_SET);
-        length = fread(buf, 1, length, fp);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, length);
+        length = readAt(offset, buf, length);
+        STATS_COUNT(stats.bytes_read, length);
         
         Memory mem(buf, length);
         
@@ -75,6 +107,17 @@ namespace nrcore {
     }
     
     void File::write(size_t offset, const char* data, size_t length) {
+        STATS_TIME(stats.write_latency);
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.bytes_written, length);
+        
+        if (mapped) {
+            if (offset+length > sz)
+                resize(offset+length);
+            memcpy(&map[offset], data, length);
+            return;
+        }
+        
         size_t len = 0;
         if (update_file) {
             if (offset < this->offset) { // copy preceeding bytes
@@ -87,7 +130,7 @@ namespace nrcore {
             
             if (length) {
                 if (offset >= this->offset && offset < this->offset+fill) {
-                    size_t coffset = this->offset - offset;
+                    size_t coffset = offset - this->offset;
                     len = (fill-coffset) < length ? fill-coffset : length;
                     char *buf = &buffer.getPtr()[coffset];
                     memcpy(buf, data, len);
@@ -110,15 +153,55 @@ namespace nrcore {
     }
 
     Memory File::read(size_t offset, size_t length) const {
-        Memory buffer(length);
+        STATS_TIME(stats.read_latency);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, length);
         
-        fseek(fp, offset, SEEK_SET);
-        size_t fill = fread(buffer.getPtr(), 1, length, fp);
-        fseek(fp, this->offset, SEEK_SET);
+        if (mapped) {
+            if (offset >= sz)
+                return Memory();
+            size_t len = offset+length > sz ? sz-offset : length;
+            STATS_COUNT(stats.bytes_read, len);
+            return Memory(&map[offset], len);
+        }
+        
+        Memory buffer(length);
+        size_t fill = readAt(offset, buffer.getPtr(), length);
+        STATS_COUNT(stats.bytes_read, fill);
         
         return Memory(buffer.operator char *(), fill);
     }
     
+    size_t File::read(size_t offset, char *data, size_t length) const {
+        STATS_TIME(stats.read_latency);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, length);
+        
+        if (mapped) {
+            if (offset >= sz)
+                return 0;
+            if (offset+length > sz)
+                length = sz-offset;
+            memcpy(data, &map[offset], length);
+            STATS_COUNT(stats.bytes_read, length);
+            return length;
+        }
+        
+        size_t len = readAt(offset, data, length);
+        STATS_COUNT(stats.bytes_read, len);
+        return len;
+    }
+    
+    const char* File::getMapping(size_t offset, size_t length) const {
+        if (!mapped || offset+length > sz)
+            return 0;
+        return &map[offset];
+    }
+    
+    bool File::isMapped() const {
+        return mapped;
+    }
+    
     size_t File::length() const {
         return sz;
     }
@@ -128,45 +211,228 @@ namespace nrcore {
     }
     
     void File::grow(size_t size) {
-        char byte = 0;
-        fseek(fp, 0, SEEK_END);
+        reserve(sz+size);
+    }
+    
+    void File::reserve(size_t length) {
+        if (length <= sz)
+            return;
         
-        sz += size;
+        if (mapped) {
+            resize(length);
+            return;
+        }
         
-        while(size--)
-            fwrite(&byte, 1, 1, fp);
+        // Buffered writes go out first, the space past them is left as a hole
+        STATS_COUNT(stats.fflushes, 1);
+        fflush(fp);
+        if (ftruncate(::fileno(fp), length) != 0)
+            throw "Failed to resize file";
+        
+        sz = length;
     }
     
     void File::truncate() {
         if (fp) {
             offset = 0;
             fp = freopen(NULL, "w+", fp);
+            
+            if (mapped) {
+                sz = 0;
+                file_size = 0;
+                remap(0);
+            }
         }
     }
     
+    void File::reopen() {
+        if (update_file)
+            updateFile();
+        
+        if (map) {
+            munmap(map, map_size);
+            map = 0;
+            map_size = 0;
+        }
+        
+        if (fp) {
+            trim();
+            fclose(fp);
+        }
+        
+        fp = fopen(path.operator char *(), "r+");
+        if (!fp)
+            throw "Failed to open";
+        
+        offset = 0;
+        fill = 0;
+        updateFileSize();
+        
+        if (mapped) {
+            file_size = sz;
+            remap(sz);
+            return;
+        }
+        
+        fill = fread(buffer.getPtr(), 1, FILE_BUFFER_SIZE, fp);
+    }
+    
+    void File::sync() {
+        STATS_TIME(stats.sync_latency);
+        STATS_COUNT(stats.syncs, 1);
+        
+        if (map) {
+            msync(map, sz, MS_SYNC);
+            trim();
+        }
+        
+        STATS_COUNT(stats.fflushes, 1);
+        fflush(fp);
+        fsync(::fileno(fp));
+    }
+    
     int File::fileno() {
         return ::fileno(fp);
     }
+    
+    File::FILE_STATS File::getStats() const {
+        FILE_STATS ret;
+        memset(&ret, 0, sizeof(FILE_STATS));
+        
+#if !STATS_DISABLED
+        ret.reads = stats.reads.get();
+        ret.bytes_requested = stats.bytes_requested.get();
+        ret.bytes_read = stats.bytes_read.get();
+        ret.preads = stats.preads.get();
+        ret.writes = stats.writes.get();
+        ret.bytes_written = stats.bytes_written.get();
+        ret.fseeks = stats.fseeks.get();
+        ret.fwrites = stats.fwrites.get();
+        ret.fflushes = stats.fflushes.get();
+        ret.syncs = stats.syncs.get();
+        ret.remaps = stats.remaps.get();
+        stats.read_latency.snapshot(&ret.read_latency);
+        stats.write_latency.snapshot(&ret.write_latency);
+        stats.sync_latency.snapshot(&ret.sync_latency);
+#endif
+        
+        return ret;
+    }
+    
+    void File::resetStats() {
+#if !STATS_DISABLED
+        stats.reads.reset();
+        stats.bytes_requested.reset();
+        stats.bytes_read.reset();
+        stats.preads.reset();
+        stats.writes.reset();
+        stats.bytes_written.reset();
+        stats.fseeks.reset();
+        stats.fwrites.reset();
+        stats.fflushes.reset();
+        stats.syncs.reset();
+        stats.remaps.reset();
+        stats.read_latency.reset();
+        stats.write_latency.reset();
+        stats.sync_latency.reset();
+#endif
+    }
 
+    void File::remap(size_t size) {
+        // Reserve at least double what is needed, pages past the end of the file are never touched
+        size_t new_size = map_size ? map_size : FILE_MAP_MIN_SIZE;
+        while (new_size < size)
+            new_size *= 2;
+        
+        if (map) {
+            if (new_size == map_size)
+                return;
+            munmap(map, map_size);
+        }
+        
+        STATS_COUNT(stats.remaps, 1);
+        map = (char*)mmap(0, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, ::fileno(fp), 0);
+        if (map == MAP_FAILED) {
+            map = 0;
+            map_size = 0;
+            throw "Failed to map file";
+        }
+        
+        map_size = new_size;
+    }
+    
+    void File::resize(size_t size) {
+        // Appends within the space already on disk only move sz
+        if (size > map_size)
+            remap(size);
+        
+        if (size > file_size) {
+            if (ftruncate(::fileno(fp), map_size) != 0)
+                throw "Failed to resize file";
+            file_size = map_size;
+        }
+        
+        sz = size;
+    }
+    
+    bool File::trim() {
+        // Space past sz only holds zeros, a file left longer is still read correctly
+        if (file_size <= sz)
+            return true;
+        
+        if (ftruncate(::fileno(fp), sz) != 0)
+            return false;
+        file_size = sz;
+        return true;
+    }
+    
     void File::updateFileSize() {
+        STATS_COUNT(stats.fseeks, 2);
         fseek(fp, 0L, SEEK_END);
         sz = ftell(fp);
         fseek(fp, 0L, SEEK_SET);
     }
     
     void File::updateFile(){
+        STATS_COUNT(stats.fseeks, 1);
         fseek(fp, offset, SEEK_SET);
         size_t written = 0;
-        while(written < fill)
-            fwrite(&buffer.getPtr()[written], 1, fill, fp);
+        while(written < fill) {
+            STATS_COUNT(stats.fwrites, 1);
+            size_t len = fwrite(&buffer.getPtr()[written], 1, fill-written, fp);
+            if (!len)
+                break;
+            written += len;
+        }
+        STATS_COUNT(stats.fflushes, 1);
         fflush(fp);
     }
     
+    size_t File::readAt(size_t offset, char *data, size_t length) const {
+        // Positional reads leave the stream position alone, so any number of threads can read at once
+        size_t done = 0;
+        while (done < length) {
+            STATS_COUNT(stats.preads, 1);
+            ssize_t len = pread(::fileno(fp), &data[done], length-done, offset+done);
+            if (len <= 0)
+                break;
+            done += len;
+        }
+        return done;
+    }
+    
     void File::writeToFile(size_t offset, const char* data, size_t length) {
+        STATS_COUNT(stats.fseeks, 1);
         fseek(fp, offset, SEEK_SET);
         size_t written = 0;
-        while(written < length)
-            written += fwrite(&data[written], 1, length, fp);
+        while(written < length) {
+            STATS_COUNT(stats.fwrites, 1);
+            size_t len = fwrite(&data[written], 1, length-written, fp);
+            if (!len)
+                break;
+            written += len;
+        }
+        STATS_COUNT(stats.fflushes, 1);
         fflush(fp);
     }
 
@@ -11,29 +11,59 @@
 
 #include <stdio.h>
 #define FILE_BUFFER_SIZE        4096
+#define FILE_MAP_MIN_SIZE       (1024*1024)
 
 #include <stdio.h>
 
 #include <libnrcore/memory/Memory.h>
 
+#include "Stats.h"
+
 namespace nrcore {
     
     class File : public Memory {
     public:
-        File(const char *path);
+        // Counts since the file was opened or the last resetStats, all zero when built with --disable-stats
+        typedef struct {
+            unsigned long long reads;
+            unsigned long long bytes_requested;
+            unsigned long long bytes_read;
+            unsigned long long preads;
+            unsigned long long writes;
+            unsigned long long bytes_written;
+            unsigned long long fseeks;
+            unsigned long long fwrites;
+            unsigned long long fflushes;
+            unsigned long long syncs;
+            unsigned long long remaps;
+            LATENCY_HISTOGRAM read_latency;
+            LATENCY_HISTOGRAM write_latency;
+            LATENCY_HISTOGRAM sync_latency;
+        } FILE_STATS;
+        
+        File(const char *path, bool mapped=false);
         virtual ~File();
         
         char& operator [](size_t index);
         Memory getMemory() const;
         Memory getSubBytes(size_t offset, size_t length) const;
         void write(size_t offset, const char* data, size_t length);
-        Memory read(size_t offset, size_t length) const;
+        Memory read(size_t offset, size_t length) const; // Safe to call from several threads while nothing writes
+        size_t read(size_t offset, char *data, size_t length) const;
+        const char* getMapping(size_t offset, size_t length) const; // Only valid until the next write, 0 when not mapped
+        bool isMapped() const;
         virtual size_t length() const;
         void setFileUpdating(bool val);
         void grow(size_t size);
+        void reserve(size_t length); // Extends the file to length without writing, the new space reads back as zeros
         void truncate();
+        void sync();
+        void reopen(); // Picks up a file that has replaced the one at path
         int fileno();
         
+        FILE_STATS getStats() const;
+        void resetStats();
+        
     private:
         FILE* fp;
         size_t sz;
@@ -45,9 +75,41 @@ namespace nrcore {
         
         bool update_file;
         
+        // Memory mapped mode, the mapping is reserved beyond the end of the file so appends rarely remap.
+        // The file on disk is extended to the whole mapping at once, sz is the length written so far and
+        // sync and the destructor trim the file back to it.
+        bool mapped;
+        char *map;
+        size_t map_size;
+        size_t file_size;
+        
+#if !STATS_DISABLED
+        mutable struct {
+            StatsCounter reads;
+            StatsCounter bytes_requested;
+            StatsCounter bytes_read;
+            StatsCounter preads;
+            StatsCounter writes;
+            StatsCounter bytes_written;
+            StatsCounter fseeks;
+            StatsCounter fwrites;
+            StatsCounter fflushes;
+            StatsCounter syncs;
+            StatsCounter remaps;
+            StatsHistogram read_latency;
+            StatsHistogram write_latency;
+            StatsHistogram sync_latency;
+        } stats;
+#endif
+        
+        void remap(size_t size);
+        void resize(size_t size);
+        bool trim(); // false when the file could not be shortened
+        
         void updateFileSize();
         
         void updateFile();
+        size_t readAt(size_t offset, char *data, size_t length) const;
         void writeToFile(size_t offset, const char* data, size_t length);
     };
     
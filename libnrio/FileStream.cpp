@@ -43,11 +43,52 @@ namespace nrcore {
     }
     
     ssize_t FileStream::write(const char* buf, size_t sz) {
-        return fwrite(buf, sz, 1, file);
+        STATS_TIME(stats.write_latency);
+        ssize_t ret = fwrite(buf, sz, 1, file);
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.bytes_written, ret*sz);
+        return ret;
     }
     
     ssize_t FileStream::read(char* buf, size_t sz) {
-        return fread(buf, sz, 1, file);
+        STATS_TIME(stats.read_latency);
+        ssize_t ret = fread(buf, sz, 1, file);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, sz);
+        STATS_COUNT(stats.bytes_read, ret*sz);
+        return ret;
+    }
+    
+    void FileStream::readAsync(AsyncIO::IO_REQUEST *request, char* buf, size_t sz, AsyncIO::Callback callback, void *context) {
+        if (!file) {
+            Stream::readAsync(request, buf, sz, callback, context);
+            return;
+        }
+        
+        // Buffered writes go out first, seeking past the request drops anything read ahead
+        fflush(file);
+        off_t position = ftello(file);
+        fseeko(file, position+sz, SEEK_SET);
+        
+        AsyncIO::prepare(request, fd, ASYNC_IO_READ, position, buf, sz, callback, context);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, sz);
+        AsyncIO::getShared().submit(request);
+    }
+    
+    void FileStream::writeAsync(AsyncIO::IO_REQUEST *request, const char* buf, size_t sz, AsyncIO::Callback callback, void *context) {
+        if (!file) {
+            Stream::writeAsync(request, buf, sz, callback, context);
+            return;
+        }
+        
+        fflush(file);
+        off_t position = ftello(file);
+        fseeko(file, position+sz, SEEK_SET);
+        
+        AsyncIO::prepare(request, fd, ASYNC_IO_WRITE, position, (char*)buf, sz, callback, context);
+        STATS_COUNT(stats.writes, 1);
+        AsyncIO::getShared().submit(request);
     }
     
     off_t FileStream::getfileSize() {
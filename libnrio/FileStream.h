@@ -32,6 +32,9 @@ namespace nrcore {
         ssize_t write(const char* buf, size_t sz);
         ssize_t read(char* buf, size_t sz);
         
+        void readAsync(AsyncIO::IO_REQUEST *request, char* buf, size_t sz, AsyncIO::Callback callback=0, void *context=0);
+        void writeAsync(AsyncIO::IO_REQUEST *request, const char* buf, size_t sz, AsyncIO::Callback callback=0, void *context=0);
+        
         off_t getfileSize();
         
         void flush();
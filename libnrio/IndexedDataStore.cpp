@@ -11,10 +11,113 @@
 #include <libnrcore/memory/Array.h>
 #include <libnrcore/memory/ByteArray.h>
 
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+
 namespace nrcore {
 
-    IndexedDataStore::IndexedDataStore(String path) : file(path) {
+    // Layouts are part of the file format, a change here needs a new STORE_FORMAT_VERSION
+    static_assert(sizeof(IndexedDataStore::INDEX_DESCRIPTOR) == 160, "INDEX_DESCRIPTOR layout changed");
+    static_assert(sizeof(IndexedDataStore::BANK_MAP) == 136, "BANK_MAP layout changed");
+    static_assert(sizeof(IndexedDataStore::PREFIX_DESCRIPTOR) == 64, "PREFIX_DESCRIPTOR layout changed");
+    static_assert(sizeof(IndexedDataStore::SUPERBLOCK) == 64, "SUPERBLOCK layout changed");
+    static_assert(sizeof(IndexedDataStore::COMPACT_INDEX_DESCRIPTOR) == 128, "COMPACT_INDEX_DESCRIPTOR layout changed");
+    static_assert(sizeof(IndexedDataStore::COMPACT_BANK_MAP) == 128, "COMPACT_BANK_MAP layout changed");
+    static_assert(sizeof(IndexedDataStore::FILE_DESCRIPTOR) == 56, "FILE_DESCRIPTOR layout changed");
+    static_assert(sizeof(IndexedDataStore::DATA_BLOCK_DESCRIPTOR) == 24, "DATA_BLOCK_DESCRIPTOR layout changed");
+    static_assert(sizeof(IndexedDataStore::BLOCK_INDEX) == 16+8*BLOCK_INDEX_SIZE, "BLOCK_INDEX layout changed");
+    static_assert(sizeof(IndexedDataStore::FREE_BLOCK) == 16, "FREE_BLOCK layout changed");
+    static_assert(sizeof(IndexedDataStore::FREE_LIST) == 24, "FREE_LIST layout changed");
+
+    static unsigned long long toNodeNumber(unsigned long long offset) {
+        if (offset % NODE_ALIGN || offset/NODE_ALIGN > NODE_NUMBER_MAX)
+            throw "Node offset out of range";
+        return offset/NODE_ALIGN;
+    }
+
+    static void encodeNodeLink(unsigned long long offset, bool flag, uint32_t *link, uint16_t *high) {
+        unsigned long long number = toNodeNumber(offset);
+        *link = (uint32_t)(number & NODE_NUMBER_MASK) | (flag ? NODE_NUMBER_FLAG : 0);
+        *high = (uint16_t)(number >> NODE_NUMBER_HIGH_SHIFT);
+    }
+
+    static unsigned long long decodeNodeLink(uint32_t link, uint16_t high) {
+        return (((unsigned long long)high << NODE_NUMBER_HIGH_SHIFT) | (link & NODE_NUMBER_MASK))*NODE_ALIGN;
+    }
+
+    static void encodeIndexNode(const IndexedDataStore::INDEX_DESCRIPTOR *descriptor, IndexedDataStore::COMPACT_INDEX_DESCRIPTOR *node) {
+        memset(node, 0, sizeof(IndexedDataStore::COMPACT_INDEX_DESCRIPTOR));
+        node->magic_flag = descriptor->magic_flag;
+        node->range_start = descriptor->range_start;
+        node->file = descriptor->file;
+        
+        unsigned long long next = descriptor->next_index_descriptor;
+        if (next)
+            encodeNodeLink(next & ~NEXT_BANK_MAP, (next & NEXT_BANK_MAP) != 0, &node->next_index_descriptor, &node->next_high);
+        
+        for (int i=0; i<BANK_SIZE; i++) {
+            unsigned long long slot = descriptor->slot[i];
+            if (slot & SLOT_OFFSET_MASK)
+                encodeNodeLink(slot & SLOT_OFFSET_MASK, (slot & SLOT_PREFIX) != 0, &node->slot[i], &node->slot_high[i]);
+        }
+    }
+
+    static void decodeIndexNode(const IndexedDataStore::COMPACT_INDEX_DESCRIPTOR *node, IndexedDataStore::INDEX_DESCRIPTOR *descriptor) {
+        memset(descriptor, 0, sizeof(IndexedDataStore::INDEX_DESCRIPTOR));
+        descriptor->magic_flag = node->magic_flag;
+        descriptor->range_start = node->range_start;
+        descriptor->file = node->file;
+        
+        if (node->next_index_descriptor || node->next_high)
+            descriptor->next_index_descriptor = decodeNodeLink(node->next_index_descriptor, node->next_high) | (node->next_index_descriptor & NODE_NUMBER_FLAG ? NEXT_BANK_MAP : 0);
+        
+        for (int i=0; i<BANK_SIZE; i++) {
+            if (node->slot[i] || node->slot_high[i])
+                descriptor->slot[i] = decodeNodeLink(node->slot[i], node->slot_high[i]) | SLOT_IN_USE | (node->slot[i] & NODE_NUMBER_FLAG ? SLOT_PREFIX : 0);
+        }
+    }
+
+    static bool compareFirst(const std::pair<unsigned long long, int> &a, const std::pair<unsigned long long, int> &b) {
+        return a.first < b.first;
+    }
+
+    // Shorter keys first, so the nodes near the root are created before the ones below them
+    struct LengthOrder {
+        std::vector<Memory> *keys;
+        
+        bool operator()(size_t a, size_t b) const {
+            Memory &ka = (*keys)[a], &kb = (*keys)[b];
+            if (ka.length() != kb.length())
+                return ka.length() < kb.length();
+            return memcmp(ka.operator char *(), kb.operator char *(), ka.length()) < 0;
+        }
+    };
+
+    static double elapsedSince(const struct timespec &start) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec-start.tv_sec) + (now.tv_nsec-start.tv_nsec)/1e9;
+    }
+
+    // Byte order, which is the order of the key trie
+    struct KeyOrder {
+        Array<Memory> *keys;
+        
+        bool operator()(int a, int b) const {
+            Memory ka = keys->get(a), kb = keys->get(b);
+            size_t len = ka.length() < kb.length() ? ka.length() : kb.length();
+            int cmp = memcmp(ka.operator char *(), kb.operator char *(), len);
+            return cmp ? cmp < 0 : ka.length() < kb.length();
+        }
+    };
+
+    IndexedDataStore::IndexedDataStore(String path, size_t cache_size, bool mapped) : path(path), file(path, mapped), cache(mapped ? 0 : cache_size), wal(path), batch_depth(0), modifications(0), format_version(STORE_FORMAT_VERSION), root_offset(0), node_extent(0), node_next(0), superblock_next(0), batch_node_extent(0), batch_node_next(0) {
+        wal.replay(file);
+        
         if (file.length()==0) {
+            // Superblock and the recycled blocks file descriptor, then the root, system and user nodes in the first extent
             INDEX_DESCRIPTOR root_descriptor;
             INDEX_DESCRIPTOR system_descriptor;
             INDEX_DESCRIPTOR user_descriptor;
@@ -29,39 +132,61 @@ namespace nrcore {
             system_descriptor.magic_flag = MAGIC_FLAG_INDEX;
             user_descriptor.magic_flag = MAGIC_FLAG_INDEX;
             
-            root_descriptor.slot[0] = sizeof(INDEX_DESCRIPTOR);   // Offset of system descriptor
-            root_descriptor.slot[1] = sizeof(INDEX_DESCRIPTOR)*2; // Offset of user descriptor
-            root_descriptor.file = sizeof(INDEX_DESCRIPTOR)*3;
+            writeRaw(sizeof(SUPERBLOCK), (const char*)&recycled_blocks_file, LEGACY_FILE_DESCRIPTOR_SIZE);
+            root_descriptor.file = sizeof(SUPERBLOCK);
             
-            file.write(0, (const char*)&root_descriptor, sizeof(INDEX_DESCRIPTOR));
-            file.write(sizeof(INDEX_DESCRIPTOR), (const char*)&system_descriptor, sizeof(INDEX_DESCRIPTOR));
-            file.write(sizeof(INDEX_DESCRIPTOR)*2, (const char*)&user_descriptor, sizeof(INDEX_DESCRIPTOR));
-            file.write(sizeof(INDEX_DESCRIPTOR)*3, (const char*)&recycled_blocks_file, sizeof(FILE_DESCRIPTOR));
-        }
+            unsigned long long offset = allocateNode(indexNodeSize());
+            writeIndexNode(offset, &system_descriptor);
+            root_descriptor.slot[0] = offset | SLOT_IN_USE;
+            
+            offset = allocateNode(indexNodeSize());
+            writeIndexNode(offset, &user_descriptor);
+            root_descriptor.slot[1] = offset | SLOT_IN_USE;
+            
+            offset = allocateNode(indexNodeSize());
+            writeIndexNode(offset, &root_descriptor);
+            
+            root_offset = offset;
+            writeSuperblock(node_next);
+        } else
+            openSuperblock();
+        
+        openRecycledBlocks();
+        rebuildFilter();
     }
 
     IndexedDataStore::~IndexedDataStore() {
+        // Nodes allocated outside a batch since the superblock was last written are recorded now
+        if (!batch_depth && root_offset && node_next != superblock_next)
+            writeSuperblock(node_next);
         
+        // An open batch is discarded, everything committed is already in the log
+        wal.checkpoint(file);
     }
 
-    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::createFile(Memory key, unsigned int block_size) {
-        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = getUserDecriptor();
-        
-        for (int i=0; i<key.length(); i++) {
-            desc = getChildDescriptor(desc, (unsigned char)(key.getPtr()[i]&0xFF), true);
-            if (!desc.getPtr())
-                throw "Failed to get file key";
-        }
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::createFile(Memory key, unsigned int block_size, unsigned int flags) {
+        ReadWriteLock::Writer writer(lock);
+        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, true);
+        if (!desc.getPtr())
+            throw "Failed to get file key";
         
         if (desc.getPtr()->descriptor.file)
             throw "File already exists";
         
+        Ref<LOADED_FILE_DESCRIPTOR> file = createKeyFile(desc, block_size, flags);
+        addToFilter(key);
+        
+        return file;
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::createKeyFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, unsigned int block_size, unsigned int flags) {
         FILE_DESCRIPTOR file_desc;
         memset(&file_desc, 0, sizeof(FILE_DESCRIPTOR));
-        file_desc.magic_flag = MAGIC_FLAG_FILE;
+        file_desc.magic_flag = MAGIC_FLAG_INDEXED_FILE;
         file_desc.block_size = block_size;
-        unsigned long long offset = file.length();
-        file.write(offset, (const char*)&file_desc, sizeof(FILE_DESCRIPTOR));
+        file_desc.flags = flags;
+        unsigned long long offset = allocate(sizeof(FILE_DESCRIPTOR));
+        writeDescriptor(offset, &file_desc, sizeof(FILE_DESCRIPTOR));
         
         desc.getPtr()->descriptor.file = offset;
         updateIndexDescriptor(desc);
@@ -70,111 +195,247 @@ namespace nrcore {
     }
 
     Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::getFile(Memory key) {
-        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = getUserDecriptor();
+        ReadWriteLock::Reader reader(lock);
+        return findFile(key);
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::tryGetFile(Memory key) {
+        ReadWriteLock::Reader reader(lock);
+        return lookupFile(key);
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::findFile(Memory key) {
+        Ref<LOADED_FILE_DESCRIPTOR> file = lookupFile(key);
+        if (!file.getPtr())
+            throw "Failed to get file key";
         
-        for (int i=0; i<key.length(); i++) {
-            desc = getChildDescriptor(desc, (unsigned char)(key.getPtr()[i]&0xFF), false);
-            if (!desc.getPtr())
-                throw "Failed to get file key";
+        return file;
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::lookupFile(Memory key) {
+        if (!filter.mayContain(key.operator char *(), key.length())) {
+            STATS_COUNT(stats.filter_rejects, 1);
+            return Ref<LOADED_FILE_DESCRIPTOR>();
         }
         
-        if (desc.getPtr()->descriptor.file)
-            return loadFileDescriptor(desc.getPtr()->descriptor.file);
+        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, false);
+        if (!desc.getPtr())
+            return Ref<LOADED_FILE_DESCRIPTOR>();
         
-        return Ref<LOADED_FILE_DESCRIPTOR>();
+        return loadKeyFile(desc);
     }
 
-    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::getOrCreateFile(Memory key, unsigned int block_size) {
-        Ref<LOADED_FILE_DESCRIPTOR> file;
-        try {
-            file = getFile(key);
-        } catch (...) {
-            file = createFile(key, block_size);
+    void IndexedDataStore::addToFilter(Memory key) {
+        filter.add(key.operator char *(), key.length());
+        if (filter.size() > filter.capacity())
+            rebuildFilter();
+    }
+
+    void IndexedDataStore::rebuildFilter() {
+        // Sized for twice the keys present, so a growing store rebuilds after its key count doubles
+        std::vector<Memory> keys;
+        Cursor cursor(this, Memory());
+        while (cursor.next())
+            keys.push_back(Memory(cursor.getKey(), cursor.getKeyLength()));
+        
+        filter.reset(keys.size()*2);
+        for (size_t i=0; i<keys.size(); i++)
+            filter.add(keys[i].operator char *(), keys[i].length());
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::loadKeyFile(Ref<LOADED_INDEX_DESCRIPTOR> desc) {
+        if (desc.getPtr()->descriptor.file) {
+            Ref<LOADED_FILE_DESCRIPTOR> file_desc = loadFileDescriptor(desc.getPtr()->descriptor.file);
+            
+            // Readers leave legacy files chained, they are upgraded the next time a writer opens them
+            if (isLegacyFile(file_desc) && lock.isWriter())
+                upgradeFileDescriptor(desc, file_desc);
+            return file_desc;
         }
         
+        return Ref<LOADED_FILE_DESCRIPTOR>();
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::getOrCreateFile(Memory key, unsigned int block_size, unsigned int flags) {
+        ReadWriteLock::Writer writer(lock);
+        Ref<LOADED_FILE_DESCRIPTOR> file = lookupFile(key);
+        
+        // Keys that are only part of a longer key have a descriptor but no file
+        if (!file.getPtr())
+            file = createFile(key, block_size, flags);
+        
         return file;
     }
 
-    bool IndexedDataStore::writeToFile(Ref<LOADED_FILE_DESCRIPTOR> file, Memory data, unsigned long long offset, unsigned long long length) {
-        unsigned long long file_size = getFileSize(file);
-        if (offset > file_size)
+    bool IndexedDataStore::deleteFile(Memory key) {
+        ReadWriteLock::Writer writer(lock);
+        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, false);
+        if (!desc.getPtr() || !desc.getPtr()->descriptor.file)
             return false;
         
-        if (!file.getPtr()->descriptor.first_data_block) {
-            // Create First data block must be done manually
-            DATA_BLOCK_DESCRIPTOR desc;
-            memset(&desc, 0, sizeof(DATA_BLOCK_DESCRIPTOR));
-            desc.magic_flag = MAGIC_FLAG_DATA;
-            desc.block_size = file.getPtr()->descriptor.block_size;
-            
-            unsigned long long file_offset = this->file.length();
-            this->file.write(file_offset, (const char*)&desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+        Ref<LOADED_FILE_DESCRIPTOR> file_desc = loadFileDescriptor(desc.getPtr()->descriptor.file);
+        truncateFile(file_desc, 0);
+        if (isValueFile(file_desc) || (file_desc.getPtr()->descriptor.flags & FILE_FLAG_VALUE_RECORD))
+            release(file_desc.getPtr()->offset, sizeof(VALUE_RECORD));
+        else if (isIndexedFile(file_desc))
+            release(file_desc.getPtr()->offset, sizeof(FILE_DESCRIPTOR));
+        
+        desc.getPtr()->descriptor.file = 0;
+        updateIndexDescriptor(desc);
+        
+        return true;
+    }
+
+    bool IndexedDataStore::truncateFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long size) {
+        ReadWriteLock::Writer writer(lock);
+        resolveFile(file);
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        if (size > fd->file_size)
+            return false;
+        
+        if (isValueFile(file)) {
+            fd->file_size = size;
+            updateFileDescriptor(file);
+            return true;
+        }
+        
+        unsigned int block_size = fd->block_size;
+        unsigned long long keep = block_size ? (size+block_size-1)/block_size : 0;
+        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> last;
+        
+        if (isIndexedFile(file)) {
+            if (keep)
+                last = loadDataDescriptor(getDataBlockOffset(file, (unsigned int)(keep-1)));
             
-            Memory mem(file.getPtr()->descriptor.block_size);
-            for (int i=0; i<file.getPtr()->descriptor.block_size; i++) {
-                mem.getPtr()[i] = 0;
+            if (fd->block_index) {
+                if (keep) {
+                    unsigned long long span = 1;
+                    for (unsigned int i=loadBlockIndex(fd->block_index).getPtr()->descriptor.depth; i>0; i--)
+                        span *= BLOCK_INDEX_SIZE;
+                    releaseBlockIndex(fd->block_index, 0, span, keep);
+                } else {
+                    releaseBlockIndex(fd->block_index, 0, 0, 0);
+                    fd->block_index = 0;
+                }
+            }
+            fd->block_count = (unsigned int)keep;
+        } else {
+            // Chained files are walked to the last block kept, everything after it is released
+            unsigned long long offset = fd->first_data_block;
+            for (unsigned long long i=0; offset; i++) {
+                Ref<LOADED_DATA_BLOCK_DESCRIPTOR> block = loadDataDescriptor(offset);
+                if (i+1 == keep)
+                    last = block;
+                else if (i >= keep)
+                    release(offset, sizeof(DATA_BLOCK_DESCRIPTOR)+block.getPtr()->descriptor.block_size);
+                offset = block.getPtr()->descriptor.next_data_block;
             }
-            this->file.write(file_offset+sizeof(DATA_BLOCK_DESCRIPTOR), mem.operator char *(), file.getPtr()->descriptor.block_size);
+        }
+        
+        if (last.getPtr() && isCompressedFile(file)) {
+            // The last block kept is decoded and stored again at its new length
+            last.getPtr()->descriptor.next_data_block = 0;
+            updateDataBlockDescriptor(last);
             
-            file.getPtr()->descriptor.first_data_block = file_offset;
-            file.getPtr()->descriptor.last_data_block = file_offset;
-            //updateFileDescriptor(file);
+            Memory block(block_size);
+            readBlockData(file, last.getPtr()->offset, &last.getPtr()->descriptor, block.operator char *());
+            fd->last_data_block = storeCompressedBlock(file, (unsigned int)(keep-1), block.operator char *(), (unsigned int)(size-(keep-1)*block_size));
+        } else if (last.getPtr()) {
+            last.getPtr()->descriptor.next_data_block = 0;
+            last.getPtr()->descriptor.used_bytes = (unsigned int)(size-(keep-1)*block_size);
+            updateDataBlockDescriptor(last);
+            fd->last_data_block = last.getPtr()->offset;
+        } else {
+            fd->first_data_block = 0;
+            fd->last_data_block = 0;
+        }
+        
+        fd->file_size = size;
+        updateFileDescriptor(file);
+        
+        return true;
+    }
+
+    bool IndexedDataStore::writeToFile(Ref<LOADED_FILE_DESCRIPTOR> file, Memory data, unsigned long long offset, unsigned long long length) {
+        return writeToFile(file, data.operator char *(), offset, length);
+    }
+
+    bool IndexedDataStore::writeToFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length) {
+        ReadWriteLock::Writer writer(lock);
+        STATS_TIME(stats.write_latency);
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.bytes_written, length);
+        
+        resolveFile(file);
+        unsigned long long file_size = getFileSize(file);
+        
+        if (isValueFile(file)) {
+            if (offset+length <= INLINE_VALUE_SIZE) {
+                writeValueFile(file, data, offset, length);
+                return true;
+            }
+            convertValueFile(file);
+        }
+        
+        if (offset > file_size) {
+            extendFile(file, offset);
+            file_size = offset;
         }
         
-        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> desc = loadDataDescriptor(file.getPtr()->descriptor.first_data_block);
+        if (isCompressedFile(file))
+            return writeCompressedFile(file, data, offset, length);
+        
         unsigned long long block_offset = 0;
-        int cursor = 0;
+        unsigned int cursor = 0;
         unsigned long long written = 0;
-
-        // Get block where offset resides
-        // This causes a major slow down when there are thousands of blocks
-        // Most of the time we are just appending data, though an index in a later version would be good. Just jumping to the last block will work for appending.
-        if (offset == file_size && file_size%file.getPtr()->descriptor.block_size == 0) {
-            // This optimisation will only work when appending whole blocks
-            block_offset = offset;
-            desc = loadDataDescriptor(file.getPtr()->descriptor.last_data_block);
-            if (offset)
-                desc = createDataBlock(file, desc);
-        } else {
-            while(desc.getPtr() && desc.getPtr()->descriptor.used_bytes == desc.getPtr()->descriptor.block_size && (desc.getPtr()->descriptor.used_bytes+block_offset) <= offset) {
-                if (desc.getPtr()->descriptor.next_data_block) {
-                    desc = loadDataDescriptor(desc.getPtr()->descriptor.next_data_block);
-                    block_offset += desc.getPtr()->descriptor.block_size;
-                } else {
-                    desc = createDataBlock(file, desc);
-                    block_offset += file.getPtr()->descriptor.block_size;
-                }
+        
+        if (!file.getPtr()->descriptor.first_data_block) {
+            if (length > file.getPtr()->descriptor.block_size) {
+                appendDataBlocks(file, Ref<LOADED_DATA_BLOCK_DESCRIPTOR>(), data, length);
+                file.getPtr()->descriptor.file_size = length;
+                updateFileDescriptor(file);
+                return true;
             }
+            
+            createDataBlock(file, Ref<LOADED_DATA_BLOCK_DESCRIPTOR>());
         }
+
+        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> desc = seekDataBlock(file, offset, &block_offset, true);
             
         if (!desc.getPtr())
             throw "Reached EOF before offset was located";
             
         if (offset > block_offset && offset < block_offset+desc.getPtr()->descriptor.block_size)
-            cursor = int(offset-block_offset);
+            cursor = (unsigned int)(offset-block_offset);
         
         while (written < length) {
             unsigned long long len = desc.getPtr()->descriptor.block_size - cursor;
+            unsigned int start = cursor;
             
             if (length-written < len)
                 len = length-written;
             
             for (unsigned long long i=0; i<len; i++) {
-                desc.getPtr()->data.getPtr()[cursor++] = data.getPtr()[written++];
+                desc.getPtr()->data.getPtr()[cursor++] = data[written++];
             }
+            markDataBlockDirty(desc, start, cursor);
             
-            if (cursor > desc.getPtr()->descriptor.used_bytes) {
+            bool grown = cursor > desc.getPtr()->descriptor.used_bytes;
+            if (grown)
                 desc.getPtr()->descriptor.used_bytes = cursor;
-                updateDataBlockDescriptor(desc);
-            }
             
-            updateDataBlockData(desc);
+            updateDataBlockData(desc, grown);
             
             if (written<length) {
                 block_offset += desc.getPtr()->descriptor.block_size;
                 
                 if (desc.getPtr()->descriptor.next_data_block) {
+                    STATS_COUNT(stats.chain_hops, 1);
                     desc = loadDataDescriptor(desc.getPtr()->descriptor.next_data_block);
+                } else if (length-written > desc.getPtr()->descriptor.block_size) {
+                    appendDataBlocks(file, desc, data+written, length-written);
+                    written = length;
+                    break;
                 } else {
                     desc = createDataBlock(file, desc);
                 }
@@ -195,205 +456,775 @@ namespace nrcore {
     }
 
     Memory IndexedDataStore::readFromFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length) {
-        ByteArray ret;
-        
+        ReadWriteLock::Reader reader(lock);
+        return readFileData(file, offset, length);
+    }
+
+    unsigned long long IndexedDataStore::readFromFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, char *buffer, unsigned long long length) {
+        ReadWriteLock::Reader reader(lock);
+        return readFileRuns(file, offset, length, buffer, 0, 0);
+    }
+
+    unsigned long long IndexedDataStore::visitFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, BlockVisitor visitor, void *context) {
+        ReadWriteLock::Reader reader(lock);
+        return readFileRuns(file, offset, length, 0, visitor, context);
+    }
+
+    Memory IndexedDataStore::readFileData(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length) {
         unsigned long long file_size = getFileSize(file);
         if (offset >= file_size)
+            return Memory();
+        
+        if (length > file_size-offset)
+            length = file_size-offset;
+        
+        Memory ret((size_t)length);
+        unsigned long long len = readFileRuns(file, offset, length, ret.operator char *(), 0, 0);
+        if (len == length)
             return ret;
         
-        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> desc = loadDataDescriptor(file.getPtr()->descriptor.first_data_block);
-        int cursor = 0;
+        return Memory(ret.operator char *(), (size_t)len);
+    }
+
+    unsigned long long IndexedDataStore::readFileRuns(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, char *buffer, BlockVisitor visitor, void *context, std::vector<AsyncIO::IO_REQUEST> *deferred) {
+        // Only data block descriptors are loaded, the data itself is read straight into the buffer or handed to the visitor.
+        // With deferred set, raw block reads into the buffer are queued there for the caller to submit instead.
+        STATS_TIME(stats.read_latency);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, length);
         
-        // Get block where offset resides
-        while(desc.getPtr() && desc.getPtr()->descriptor.used_bytes == desc.getPtr()->descriptor.block_size && (desc.getPtr()->descriptor.used_bytes+cursor) <= offset) {
-            if (desc.getPtr()->descriptor.next_data_block) {
-                desc = loadDataDescriptor(desc.getPtr()->descriptor.next_data_block);
-                cursor += desc.getPtr()->descriptor.used_bytes;
-            } else {
-                return ret;
+        if (offset >= getFileSize(file))
+            return 0;
+        
+        if (isValueFile(file)) {
+            VALUE_RECORD record;
+            readDescriptor(file.getPtr()->offset, &record, sizeof(VALUE_RECORD));
+            
+            unsigned long long len = getFileSize(file)-offset;
+            if (len > length)
+                len = length;
+            
+            if (buffer)
+                memcpy(buffer, record.data+offset, (size_t)len);
+            else
+                visitor((const char*)record.data+offset, (size_t)len, offset, context);
+            
+            STATS_COUNT(stats.bytes_read, len);
+            return len;
+        }
+        
+        // Large reads of an unmapped store outside a batch do not wait on one block before asking for the next
+        std::vector<AsyncIO::IO_REQUEST> queued;
+        if (buffer && !deferred && length >= PARALLEL_READ_SIZE && !batch_depth && !this->file.isMapped()) {
+            if (isIndexedFile(file) && !isCompressedFile(file)) {
+                unsigned long long len = readIndexedBlocks(file, offset, length, buffer);
+                STATS_COUNT(stats.bytes_read, len);
+                return len;
             }
+            deferred = &queued;
         }
         
-        unsigned int _offset = (int)(offset-cursor);
-        unsigned int len = desc.getPtr()->descriptor.used_bytes-_offset;
+        DATA_BLOCK_DESCRIPTOR desc;
+        unsigned long long block_offset;
+        unsigned long long position = findDataBlock(file, offset, &block_offset, &desc);
+        unsigned long long skip = offset-block_offset;
+        unsigned long long done = 0;
+        unsigned int block_size = file.getPtr()->descriptor.block_size;
+        bool compressed = isCompressedFile(file);
+        Memory scratch;
         
-        while (ret.length()<length) {
-            ByteArray block = desc.getPtr()->data;
-            ret.append(block.subBytes(_offset, len));
+        while (position && done < length && skip < desc.used_bytes) {
+            unsigned long long len = desc.used_bytes-skip;
+            if (len > length-done)
+                len = length-done;
             
-            if (!desc.getPtr()->descriptor.next_data_block)
-                break;
+            unsigned long long data_offset = position+sizeof(DATA_BLOCK_DESCRIPTOR)+skip;
+            if (compressed && desc.block_size < block_size) {
+                // Compressed blocks are decoded whole, then the part asked for is copied or visited
+                if (scratch.length() < block_size)
+                    scratch = Memory(block_size);
+                readBlockData(file, position, &desc, scratch.operator char *());
+                
+                if (buffer)
+                    memcpy(buffer+done, scratch.operator char *()+skip, (size_t)len);
+                else if (!visitor(scratch.operator char *()+skip, (size_t)len, offset+done, context)) {
+                    STATS_COUNT(stats.bytes_read, done+len);
+                    return done+len;
+                }
+            } else if (buffer && deferred && !batch_depth && !this->file.isMapped()) {
+                AsyncIO::IO_REQUEST request;
+                AsyncIO::prepare(&request, this->file.fileno(), ASYNC_IO_READ, data_offset, buffer+done, (size_t)len);
+                deferred->push_back(request);
+            } else if (buffer) {
+                readData(data_offset, buffer+done, (size_t)len);
+            } else {
+                // Mapped stores hand out the mapping itself, otherwise one block sized buffer is reused for every block
+                const char *view = batch_depth ? 0 : this->file.getMapping(data_offset, (size_t)len);
+                if (!view) {
+                    if (scratch.length() < len)
+                        scratch = Memory(desc.block_size);
+                    readData(data_offset, scratch.operator char *(), (size_t)len);
+                    view = scratch.operator char *();
+                }
+                
+                if (!visitor(view, (size_t)len, offset+done, context)) {
+                    STATS_COUNT(stats.bytes_read, done+len);
+                    return done+len;
+                }
+            }
             
-            desc = loadDataDescriptor(desc.getPtr()->descriptor.next_data_block);
+            done += len;
+            skip = 0;
             
-            _offset = 0;
-            len = desc.getPtr()->descriptor.used_bytes;
-            if (ret.length()+len > length)
-                len = (unsigned int)(length-ret.length());
+            position = desc.next_data_block;
+            if (position) {
+                STATS_COUNT(stats.chain_hops, 1);
+                readDescriptor(position, &desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+                if (desc.magic_flag != MAGIC_FLAG_DATA)
+                    throw "Invalid data descriptor";
+            }
         }
         
-        return ret;
+        completeReads(queued);
+        
+        STATS_COUNT(stats.bytes_read, done);
+        return done;
     }
 
-    Memory IndexedDataStore::readOrSet(Memory key, Memory default_value) {
-        Ref<LOADED_FILE_DESCRIPTOR> file = getOrCreateFile(key, (int)default_value.length());
-        Memory ret = readFromFile(file, 0, default_value.length());
+    unsigned long long IndexedDataStore::readIndexedBlocks(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, char *buffer) {
+        // Block offsets come from the block index, so the descriptors of a window of blocks are read together and then
+        // their data, rather than a descriptor and a block at a time
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        unsigned int block_size = fd->block_size;
+        unsigned long long block = offset/block_size;
+        unsigned long long skip = offset%block_size;
+        unsigned long long done = 0;
         
-        if (ret.length() != default_value.length()) {
-            writeToFile(file, default_value, 0, (int)default_value.length());
-            return default_value;
+        std::vector<unsigned long long> positions;
+        std::vector<DATA_BLOCK_DESCRIPTOR> descriptors;
+        std::vector<size_t> missed;
+        std::vector<AsyncIO::IO_REQUEST> requests;
+        Ref<LOADED_BLOCK_INDEX> leaf;
+        
+        while (done < length && block < fd->block_count) {
+            unsigned long long count = (skip+length-done+block_size-1)/block_size;
+            if (count > fd->block_count-block)
+                count = fd->block_count-block;
+            if (count > PARALLEL_READ_WINDOW)
+                count = PARALLEL_READ_WINDOW;
+            
+            positions.resize((size_t)count);
+            descriptors.resize((size_t)count);
+            missed.clear();
+            requests.clear();
+            
+            for (size_t i=0; i<count; i++) {
+                unsigned int block_number = (unsigned int)(block+i);
+                if (!leaf.getPtr() || !i || block_number%BLOCK_INDEX_SIZE == 0)
+                    leaf = getBlockIndexLeaf(file, block_number, false);
+                if (!leaf.getPtr())
+                    throw "Block index is missing a data block";
+                positions[i] = leaf.getPtr()->descriptor.entry[block_number%BLOCK_INDEX_SIZE];
+                
+                STATS_COUNT(stats.descriptor_reads, 1);
+                if (cache.get(positions[i], &descriptors[i], sizeof(DATA_BLOCK_DESCRIPTOR)))
+                    continue;
+                
+                AsyncIO::IO_REQUEST request;
+                AsyncIO::prepare(&request, this->file.fileno(), ASYNC_IO_READ, positions[i], (char*)&descriptors[i], sizeof(DATA_BLOCK_DESCRIPTOR));
+                requests.push_back(request);
+                missed.push_back(i);
+            }
+            completeReads(requests);
+            
+            for (size_t i=0; i<missed.size(); i++)
+                cache.put(positions[missed[i]], &descriptors[missed[i]], sizeof(DATA_BLOCK_DESCRIPTOR));
+            
+            requests.clear();
+            size_t read = 0;
+            for (; read<count && done<length; read++) {
+                DATA_BLOCK_DESCRIPTOR *desc = &descriptors[read];
+                if (desc->magic_flag != MAGIC_FLAG_DATA)
+                    throw "Invalid data descriptor";
+                if (skip >= desc->used_bytes)
+                    break;
+                
+                unsigned long long len = desc->used_bytes-skip;
+                if (len > length-done)
+                    len = length-done;
+                
+                AsyncIO::IO_REQUEST request;
+                AsyncIO::prepare(&request, this->file.fileno(), ASYNC_IO_READ, positions[read]+sizeof(DATA_BLOCK_DESCRIPTOR)+skip, buffer+done, (size_t)len);
+                requests.push_back(request);
+                
+                done += len;
+                skip = 0;
+            }
+            completeReads(requests);
+            
+            if (read < count)
+                break;
+            block += count;
         }
-        return ret;
+        
+        return done;
     }
 
-    void IndexedDataStore::set(Memory key, Memory value) {
-        Ref<LOADED_FILE_DESCRIPTOR> file = getOrCreateFile(key, (int)value.length());
-        writeToFile(file, value, 0, value.length());
+    void IndexedDataStore::completeReads(std::vector<AsyncIO::IO_REQUEST> &requests) {
+        if (requests.empty())
+            return;
+        
+        AsyncIO &io = AsyncIO::getShared();
+        io.submit(requests.data(), requests.size());
+        io.wait(requests.data(), requests.size());
+        
+        // Blocks past the end of the store read as zeros, as they do through readData
+        for (size_t i=0; i<requests.size(); i++) {
+            size_t len = requests[i].result > 0 ? (size_t)requests[i].result : 0;
+            memset(requests[i].buffer+len, 0, requests[i].length-len);
+        }
     }
 
-    void IndexedDataStore::set(Memory key, int value) {
-        set(key, Memory(&value, sizeof(int)));
+    unsigned long long IndexedDataStore::findDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long *block_offset, DATA_BLOCK_DESCRIPTOR *desc) {
+        unsigned int block_size = file.getPtr()->descriptor.block_size;
+        unsigned long long position;
+        
+        if (isIndexedFile(file)) {
+            unsigned long long block_number = offset/block_size;
+            if (block_number >= file.getPtr()->descriptor.block_count)
+                return 0;
+            
+            *block_offset = block_number*block_size;
+            position = getDataBlockOffset(file, (unsigned int)block_number);
+            readDescriptor(position, desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+            if (desc->magic_flag != MAGIC_FLAG_DATA)
+                throw "Invalid data descriptor";
+            
+            return position;
+        }
+        
+        // Chained files walk the descriptors, full blocks can be skipped without looking at their data
+        *block_offset = 0;
+        position = file.getPtr()->descriptor.first_data_block;
+        while (position) {
+            readDescriptor(position, desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+            if (desc->magic_flag != MAGIC_FLAG_DATA)
+                throw "Invalid data descriptor";
+            
+            if (desc->used_bytes != desc->block_size || *block_offset+desc->used_bytes > offset)
+                return position;
+            
+            *block_offset += block_size;
+            position = desc->next_data_block;
+            STATS_COUNT(stats.chain_hops, 1);
+        }
+        
+        return 0;
     }
 
-    void IndexedDataStore::set(Memory key, unsigned int value) {
-        set(key, Memory(&value, sizeof(int)));
+    void IndexedDataStore::readData(unsigned long long offset, char *buffer, size_t length) {
+        if (!batch_depth) {
+            const char *mapping = file.getMapping(offset, length);
+            if (mapping) {
+                memcpy(buffer, mapping, length);
+                return;
+            }
+            
+            size_t len = file.read(offset, buffer, length);
+            memset(buffer+len, 0, length-len);
+            return;
+        }
+        
+        // Space appended by the batch is not in the file yet, the zeros there are covered by its pending writes
+        size_t len = file.read(offset, buffer, length);
+        memset(buffer+len, 0, length-len);
+        wal.overlay(offset, buffer, length);
     }
 
-    void IndexedDataStore::set(Memory key, long long value) {
-        set(key, Memory(&value, sizeof(long long)));
+    Memory IndexedDataStore::readOrSet(Memory key, Memory default_value) {
+        Memory ret((size_t)default_value.length());
+        readOrSetValue(key, default_value.operator char *(), ret.operator char *(), default_value.length());
+        return ret;
     }
 
-    void IndexedDataStore::set(Memory key, unsigned long long value) {
-        set(key, Memory(&value, sizeof(long long)));
+    void IndexedDataStore::readOrSetValue(Memory key, const void *default_value, void *value, size_t length) {
+        ReadWriteLock::Writer writer(lock);
+        if (length <= INLINE_VALUE_SIZE) {
+            Ref<LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, true);
+            if (!desc.getPtr())
+                throw "Failed to get file key";
+            
+            if (!desc.getPtr()->descriptor.file) {
+                createValueFile(desc, (const char*)default_value, length);
+                addToFilter(key);
+                memcpy(value, default_value, length);
+                return;
+            }
+        }
+        
+        Ref<LOADED_FILE_DESCRIPTOR> file = getOrCreateFile(key, (unsigned int)length);
+        unsigned long long len = length < getFileSize(file) ? length : getFileSize(file);
+        
+        if (readFileRuns(file, 0, len, (char*)value, 0, 0) != length) {
+            writeToFile(file, (const char*)default_value, 0, length);
+            memcpy(value, default_value, length);
+        }
     }
 
-    int IndexedDataStore::readOrSet(Memory key, int default_value) {
-        Memory res = readOrSet(key, Memory(&default_value, sizeof(int)));
-        int ret;
-        memcpy(&ret, res.operator char *(), sizeof(int));
-        return ret;
+    void IndexedDataStore::set(Memory key, Memory value) {
+        setValue(key, value.operator char *(), value.length());
     }
 
-    Memory IndexedDataStore::read(Memory key, unsigned int length) {
-        Ref<LOADED_FILE_DESCRIPTOR> file = getFile(key);
-        return readFromFile(file, 0, length);
+    void IndexedDataStore::setValue(Memory key, const void *value, size_t length) {
+        ReadWriteLock::Writer writer(lock);
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, true);
+        if (!desc.getPtr())
+            throw "Failed to get file key";
+        
+        Ref<LOADED_FILE_DESCRIPTOR> file = loadKeyFile(desc);
+        if (!file.getPtr()) {
+            if (length <= INLINE_VALUE_SIZE) {
+                createValueFile(desc, (const char*)value, length);
+                addToFilter(key);
+                return;
+            }
+            file = createKeyFile(desc, (unsigned int)length);
+            addToFilter(key);
+        }
+        
+        writeToFile(file, (const char*)value, 0, length);
     }
 
-    int IndexedDataStore::readInt(Memory key) {
-        Memory res = read(key, sizeof(int));
-        int ret;
-        memcpy(&ret, res.operator char *(), sizeof(int));
-        return ret;
+    void IndexedDataStore::setMany(Array<Memory> &keys, Array<Memory> &values) {
+        ReadWriteLock::Writer writer(lock);
+        if (keys.length() != values.length())
+            throw "Key and value count mismatch";
+        
+        std::vector<int> order = sortKeys(keys);
+        std::vector<PATH_ENTRY> path;
+        std::vector< std::pair<unsigned long long, int> > writes;
+        std::vector< Ref<LOADED_FILE_DESCRIPTOR> > files(order.size());
+        
+        beginBatch();
+        try {
+            Memory previous;
+            for (size_t i=0; i<order.size(); i++) {
+                int index = order[i];
+                Ref<LOADED_INDEX_DESCRIPTOR> desc = findSortedDescriptor(keys.get(index), previous, true, path);
+                
+                Ref<LOADED_FILE_DESCRIPTOR> file = loadKeyFile(desc);
+                previous = keys.get(index);
+                
+                if (!file.getPtr()) {
+                    if (values.get(index).length() <= INLINE_VALUE_SIZE) {
+                        createValueFile(desc, values.get(index));
+                        addToFilter(keys.get(index));
+                        continue;
+                    }
+                    file = createKeyFile(desc, (unsigned int)values.get(index).length());
+                    addToFilter(keys.get(index));
+                }
+                
+                // New files have no blocks yet and are appended after the existing ones
+                unsigned long long first = file.getPtr()->descriptor.first_data_block;
+                writes.push_back(std::make_pair(first ? first : ~0ULL, index));
+                files[index] = file;
+            }
+            
+            std::stable_sort(writes.begin(), writes.end(), compareFirst);
+            for (size_t i=0; i<writes.size(); i++) {
+                int index = writes[i].second;
+                writeToFile(files[index], values.get(index), 0, values.get(index).length());
+            }
+        } catch (...) {
+            rollback();
+            throw;
+        }
+        commit();
     }
 
-    long long IndexedDataStore::readLongLong(Memory key) {
-        Memory res = read(key, sizeof(long long));
-        long long ret;
-        memcpy(&ret, res.operator char *(), sizeof(long long));
+    Array<Memory> IndexedDataStore::readMany(Array<Memory> &keys, unsigned int length) {
+        ReadWriteLock::Reader reader(lock);
+        std::vector<int> order = sortKeys(keys);
+        std::vector<PATH_ENTRY> path;
+        std::vector< std::pair<unsigned long long, int> > reads;
+        std::vector< Ref<LOADED_FILE_DESCRIPTOR> > files(order.size());
+        std::vector<Memory> values(order.size());
+        
+        Memory previous;
+        for (size_t i=0; i<order.size(); i++) {
+            int index = order[i];
+            if (!filter.mayContain(keys.get(index).operator char *(), keys.get(index).length())) {
+                STATS_COUNT(stats.filter_rejects, 1);
+                continue;
+            }
+            
+            Ref<LOADED_INDEX_DESCRIPTOR> desc = findSortedDescriptor(keys.get(index), previous, false, path);
+            
+            if (desc.getPtr() && desc.getPtr()->descriptor.file) {
+                files[index] = loadKeyFile(desc);
+                reads.push_back(std::make_pair(files[index].getPtr()->descriptor.first_data_block, index));
+            }
+            previous = keys.get(index);
+        }
+        
+        std::sort(reads.begin(), reads.end(), compareFirst);
+        
+        // Block reads of an unmapped store are all queued before waiting on any, so the device sees them together
+        std::vector<AsyncIO::IO_REQUEST> requests;
+        std::vector<unsigned long long> lengths(order.size(), 0);
+        for (size_t i=0; i<reads.size(); i++) {
+            int index = reads[i].second;
+            if (batch_depth || file.isMapped()) {
+                values[index] = readFileData(files[index], 0, length);
+                continue;
+            }
+            
+            unsigned long long size = getFileSize(files[index]);
+            if (size > length)
+                size = length;
+            if (!size)
+                continue;
+            
+            values[index] = Memory((size_t)size);
+            lengths[index] = readFileRuns(files[index], 0, size, values[index].operator char *(), 0, 0, &requests);
+        }
+        
+        completeReads(requests);
+        
+        for (size_t i=0; i<values.size(); i++) {
+            if (lengths[i] && lengths[i] < values[i].length())
+                values[i] = Memory(values[i].operator char *(), (size_t)lengths[i]);
+        }
+        
+        Array<Memory> ret;
+        for (size_t i=0; i<values.size(); i++)
+            ret.push(values[i]);
+        
         return ret;
     }
 
-    unsigned int IndexedDataStore::readOrSet(Memory key, unsigned int default_value) {
-        Memory res = readOrSet(key, Memory(&default_value, sizeof(int)));
-        unsigned int ret;
-        memcpy(&ret, res.operator char *(), sizeof(int));
-        return ret;
+    std::vector<int> IndexedDataStore::sortKeys(Array<Memory> &keys) {
+        std::vector<int> order(keys.length());
+        for (size_t i=0; i<order.size(); i++)
+            order[i] = (int)i;
+        
+        KeyOrder key_order = {&keys};
+        std::stable_sort(order.begin(), order.end(), key_order);
+        
+        return order;
     }
 
-    long long IndexedDataStore::readOrSet(Memory key, long long default_value) {
-        Memory res = readOrSet(key, Memory(&default_value, sizeof(long long)));
-        unsigned long long ret;
-        memcpy(&ret, res.operator char *(), sizeof(long long));
-        return ret;
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::findSortedDescriptor(Memory key, Memory previous, bool create, std::vector<PATH_ENTRY> &path) {
+        size_t len = key.length() < previous.length() ? key.length() : previous.length();
+        size_t common = 0;
+        while (common < len && key.operator char *()[common] == previous.operator char *()[common])
+            common++;
+        
+        // Descriptors past the shared prefix belong to the previous key, the root entry is always kept
+        while (path.size() > 1 && path.back().position > common)
+            path.pop_back();
+        
+        return findDescriptor(key, create, 0, &path);
     }
 
-    unsigned long long IndexedDataStore::readOrSet(Memory key, unsigned long long default_value) {
-        Memory res = readOrSet(key, Memory(&default_value, sizeof(long long)));
-        unsigned long long ret;
-        memcpy(&ret, res.operator char *(), sizeof(long long));
-        return ret;
+    Memory IndexedDataStore::read(Memory key, unsigned int length) {
+        ReadWriteLock::Reader reader(lock);
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = findValue(key);
+        
+        VALUE_RECORD record;
+        if (readValueRecord(desc.getPtr()->descriptor.file, &record)) {
+            unsigned long long len = record.descriptor.file_size < length ? record.descriptor.file_size : length;
+            STATS_COUNT(stats.reads, 1);
+            STATS_COUNT(stats.bytes_requested, length);
+            STATS_COUNT(stats.bytes_read, len);
+            return Memory(record.data, (size_t)len);
+        }
+        
+        return readFileData(loadKeyFile(desc), 0, length);
     }
 
-    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getChildDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index) {
-        bool repeat;
+    unsigned long long IndexedDataStore::readValue(Memory key, void *value, size_t length) {
+        ReadWriteLock::Reader reader(lock);
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = findValue(key);
+        unsigned long long len;
         
-        do {
-            repeat = false;
-
-            if (descriptor.getPtr()->descriptor.next_index_descriptor & 0x8000000000000000) {
-                // This is a bank map, select correct node directly
-                printf("Bank map mode\n");
-                Ref<LOADED_BANK_MAP> bmap = loadBankMap(descriptor.getPtr()->descriptor.next_index_descriptor & 0x7FFFFFFFFFFFFFFF);
+        VALUE_RECORD record;
+        if (readValueRecord(desc.getPtr()->descriptor.file, &record)) {
+            len = record.descriptor.file_size < length ? record.descriptor.file_size : length;
+            STATS_COUNT(stats.reads, 1);
+            STATS_COUNT(stats.bytes_requested, length);
+            STATS_COUNT(stats.bytes_read, len);
+            memcpy(value, record.data, (size_t)len);
+        } else {
+            Ref<LOADED_FILE_DESCRIPTOR> file = loadKeyFile(desc);
+            len = length < getFileSize(file) ? length : getFileSize(file);
+            len = readFileRuns(file, 0, len, (char*)value, 0, 0);
+        }
+        
+        // A shorter value reads back with its missing bytes as zeros
+        memset((char*)value+len, 0, (size_t)(length-len));
+        return len;
+    }
 
-                unsigned long long slot = index/BANK_SIZE;
+    bool IndexedDataStore::readValueRecord(unsigned long long offset, VALUE_RECORD *record) {
+        // Other descriptors are followed by unrelated data, only a value record is read past its descriptor.
+        // The whole record is cached then, so the next read of the value is answered from one entry.
+        readFileDescriptor(offset, &record->descriptor);
+        if (record->descriptor.magic_flag != MAGIC_FLAG_VALUE_FILE)
+            return false;
+        
+        readDescriptor(offset, record, sizeof(VALUE_RECORD));
+        return true;
+    }
 
-                if (bmap.getPtr()->descriptor.banks[slot]) {
-                    descriptor = loadIndexDescriptor(bmap.getPtr()->descriptor.banks[slot]);
-                } else 
-                    return Ref<LOADED_INDEX_DESCRIPTOR>();
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::findValue(Memory key) {
+        if (!filter.mayContain(key.operator char *(), key.length())) {
+            STATS_COUNT(stats.filter_rejects, 1);
+            throw "Failed to get file key";
+        }
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, false);
+        if (!desc.getPtr() || !desc.getPtr()->descriptor.file)
+            throw "Failed to get file key";
+        
+        return desc;
+    }
+
+    int IndexedDataStore::readInt(Memory key) {
+        return get<int>(key);
+    }
+
+    long long IndexedDataStore::readLongLong(Memory key) {
+        return get<long long>(key);
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::findDescriptor(Memory key, bool create, int *pending, std::vector<PATH_ENTRY> *path) {
+        STATS_TIME(stats.lookup_latency);
+        STATS_COUNT(stats.lookups, 1);
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> desc;
+        const unsigned char *k = (const unsigned char*)key.operator char *();
+        size_t len = key.length();
+        size_t i = 0;
+        
+        if (pending)
+            *pending = -1;
+        
+        // A path continues from its last entry, which must be a prefix of key
+        if (path && path->size()) {
+            i = path->back().position;
+            desc = path->back().desc;
+        } else {
+            desc = getUserDecriptor();
+            if (path) {
+                PATH_ENTRY entry = {0, desc};
+                path->push_back(entry);
             }
+        }
+        
+        while (i < len) {
+            Ref<LOADED_INDEX_DESCRIPTOR> owner = getSlotDescriptor(desc, k[i], create);
+            if (!owner.getPtr())
+                return Ref<LOADED_INDEX_DESCRIPTOR>();
             
-            if (descriptor.getPtr()->descriptor.range_start <= index && descriptor.getPtr()->descriptor.range_start+BANK_SIZE > index) {
-                unsigned long long offset = descriptor.getPtr()->descriptor.slot[index-descriptor.getPtr()->descriptor.range_start];
-                if ((offset & 0x8000000000000000) == 0x8000000000000000) {
-                    // return existing descriptor
-                    return loadIndexDescriptor(offset & 0x7FFFFFFFFFFFFFFF);
-                } else if (create_index) {
-                    // Create new descriptor
-                    INDEX_DESCRIPTOR ndesc;
-                    memset(&ndesc, 0, sizeof(INDEX_DESCRIPTOR));
-                    ndesc.magic_flag = MAGIC_FLAG_INDEX;
-                    
-                    unsigned long long offset = file.length();
-                    file.write(offset, (const char*)&ndesc, sizeof(INDEX_DESCRIPTOR));
-                    
-                    descriptor.getPtr()->descriptor.slot[index-descriptor.getPtr()->descriptor.range_start] = offset | 0x8000000000000000;
-                    updateIndexDescriptor(descriptor);
-                    
-                    return loadIndexDescriptor(offset & 0x7FFFFFFFFFFFFFFF);
+            int slot = k[i]-owner.getPtr()->descriptor.range_start;
+            unsigned long long value = owner.getPtr()->descriptor.slot[slot];
+            i++;
+            
+            if (!(value & SLOT_IN_USE)) {
+                if (!create)
+                    return Ref<LOADED_INDEX_DESCRIPTOR>();
+                
+                size_t consumed = len-i < PREFIX_SEGMENT_SIZE ? len-i : PREFIX_SEGMENT_SIZE;
+                desc = createKeyPath(owner, slot, &k[i], consumed);
+                i += consumed;
+            } else if (value & SLOT_PREFIX) {
+                Ref<LOADED_PREFIX_DESCRIPTOR> prefix = loadPrefixDescriptor(value & SLOT_OFFSET_MASK);
+                PREFIX_DESCRIPTOR *pd = &prefix.getPtr()->descriptor;
+                
+                unsigned int matched = 0;
+                while (matched < pd->length && i+matched < len && pd->segment[matched] == k[i+matched])
+                    matched++;
+                
+                if (matched == pd->length) {
+                    desc = loadIndexDescriptor(pd->next_index_descriptor);
+                } else if (create) {
+                    desc = splitPrefix(owner, slot, prefix, matched);
                 } else {
-                    break;
-                }
-            } else if (create_index) {
-                // Create sibling descriptor
-                if (!descriptor.getPtr()->descriptor.next_index_descriptor) {
-                    unsigned int start_range = index-(index%BANK_SIZE);
-                    
-                    INDEX_DESCRIPTOR ndesc;
-                    memset(&ndesc, 0, sizeof(INDEX_DESCRIPTOR));
-                    ndesc.magic_flag = MAGIC_FLAG_INDEX;
-                    ndesc.range_start = start_range;
-                    
-                    unsigned long long offset = file.length();
-                    file.write(offset, (const char*)&ndesc, sizeof(INDEX_DESCRIPTOR));
-                    
-                    descriptor.getPtr()->descriptor.next_index_descriptor = offset;
-                    updateIndexDescriptor(descriptor);
+                    if (pending && i+matched == len)
+                        *pending = pd->segment[matched];
+                    return Ref<LOADED_INDEX_DESCRIPTOR>();
                 }
                 
+                i += matched;
+            } else
+                desc = loadIndexDescriptor(value & SLOT_OFFSET_MASK);
+            
+            if (path) {
+                PATH_ENTRY entry = {i, desc};
+                path->push_back(entry);
             }
+        }
+        
+        return desc;
+    }
 
-            if (descriptor.getPtr()->descriptor.next_index_descriptor & 0x8000000000000000)
-                throw "Bank map, should never reach this code";
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getSlotDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index) {
+        // Either every descriptor of a node points at its bank map or none do, descriptor is the head of the node
+        if (descriptor.getPtr()->descriptor.next_index_descriptor & NEXT_BANK_MAP)
+            return getBankSlotDescriptor(descriptor, index, create_index);
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> head = descriptor;
+        int chained = 1;
+        while (true) {
+            if (descriptor.getPtr()->descriptor.range_start <= index && descriptor.getPtr()->descriptor.range_start+BANK_SIZE > index)
+                return descriptor;
             
-            if (descriptor.getPtr()->descriptor.next_index_descriptor) {
-                descriptor = loadIndexDescriptor(descriptor.getPtr()->descriptor.next_index_descriptor);
-                repeat = true;
+            if (!descriptor.getPtr()->descriptor.next_index_descriptor) {
+                if (!create_index)
+                    return Ref<LOADED_INDEX_DESCRIPTOR>();
+                
+                // Wide nodes switch to a bank map rather than growing a longer chain
+                if (chained >= BANK_MAP_THRESHOLD && head.getPtr()->descriptor.range_start == 0) {
+                    createBankMap(head);
+                    return getBankSlotDescriptor(head, index, true);
+                }
+                
+                // Create sibling descriptor
+                Ref<LOADED_INDEX_DESCRIPTOR> sibling = createIndexDescriptor(index-(index%BANK_SIZE));
+                descriptor.getPtr()->descriptor.next_index_descriptor = sibling.getPtr()->offset;
+                updateIndexDescriptor(descriptor);
+                
+                return sibling;
             }
             
-        } while (repeat);
+            descriptor = loadIndexDescriptor(descriptor.getPtr()->descriptor.next_index_descriptor);
+            if (descriptor.getPtr()->descriptor.next_index_descriptor & NEXT_BANK_MAP)
+                return getBankSlotDescriptor(descriptor, index, create_index);
+            chained++;
+        }
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getBankSlotDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index) {
+        if (descriptor.getPtr()->descriptor.range_start <= index && descriptor.getPtr()->descriptor.range_start+BANK_SIZE > index)
+            return descriptor;
+        
+        unsigned long long map_offset = descriptor.getPtr()->descriptor.next_index_descriptor & ~NEXT_BANK_MAP;
+        Ref<LOADED_BANK_MAP> bmap = loadBankMap(map_offset);
+        unsigned long long bank = bmap.getPtr()->descriptor.banks[index/BANK_SIZE];
+        if (bank)
+            return loadIndexDescriptor(bank);
         
-        return Ref<LOADED_INDEX_DESCRIPTOR>();
+        if (!create_index)
+            return Ref<LOADED_INDEX_DESCRIPTOR>();
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> sibling = createIndexDescriptor(index-(index%BANK_SIZE));
+        sibling.getPtr()->descriptor.next_index_descriptor = map_offset | NEXT_BANK_MAP;
+        updateIndexDescriptor(sibling);
+        
+        bmap.getPtr()->descriptor.banks[index/BANK_SIZE] = sibling.getPtr()->offset;
+        updateBankMap(bmap);
+        
+        return sibling;
     }
 
-    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::loadIndexDescriptor(unsigned long long offset) {
-        Memory mem = file.read(offset, sizeof(INDEX_DESCRIPTOR));
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::createIndexDescriptor(unsigned char range_start) {
+        LOADED_INDEX_DESCRIPTOR *desc = new LOADED_INDEX_DESCRIPTOR;
+        memset(&desc->descriptor, 0, sizeof(INDEX_DESCRIPTOR));
+        desc->descriptor.magic_flag = MAGIC_FLAG_INDEX;
+        desc->descriptor.range_start = range_start;
+        desc->offset = allocateNode(indexNodeSize());
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> ret(desc);
+        updateIndexDescriptor(ret);
+        return ret;
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::createKeyPath(Ref<LOADED_INDEX_DESCRIPTOR> owner, int slot, const unsigned char *segment, size_t length) {
+        // A run of key bytes without branches is stored as one prefix node in front of the new index descriptor
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = createIndexDescriptor(0);
+        
+        if (length) {
+            Ref<LOADED_PREFIX_DESCRIPTOR> prefix = createPrefixDescriptor(segment, length, desc.getPtr()->offset);
+            owner.getPtr()->descriptor.slot[slot] = prefix.getPtr()->offset | SLOT_IN_USE | SLOT_PREFIX;
+        } else
+            owner.getPtr()->descriptor.slot[slot] = desc.getPtr()->offset | SLOT_IN_USE;
+        
+        updateIndexDescriptor(owner);
+        
+        return desc;
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::splitPrefix(Ref<LOADED_INDEX_DESCRIPTOR> owner, int slot, Ref<LOADED_PREFIX_DESCRIPTOR> prefix, unsigned int position) {
+        // The segment diverges at position, a branch descriptor is placed there and the remainder of the segment hangs off it
+        PREFIX_DESCRIPTOR *pd = &prefix.getPtr()->descriptor;
+        Ref<LOADED_INDEX_DESCRIPTOR> branch = createIndexDescriptor(0);
+        
+        unsigned char index = pd->segment[position];
+        unsigned long long child = pd->next_index_descriptor | SLOT_IN_USE;
+        if (position+1 < pd->length) {
+            Ref<LOADED_PREFIX_DESCRIPTOR> tail = createPrefixDescriptor(&pd->segment[position+1], pd->length-position-1, pd->next_index_descriptor);
+            child = tail.getPtr()->offset | SLOT_IN_USE | SLOT_PREFIX;
+        }
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> branch_owner = getSlotDescriptor(branch, index, true);
+        branch_owner.getPtr()->descriptor.slot[index-branch_owner.getPtr()->descriptor.range_start] = child;
+        updateIndexDescriptor(branch_owner);
+        
+        if (position) {
+            pd->length = position;
+            pd->next_index_descriptor = branch.getPtr()->offset;
+            updatePrefixDescriptor(prefix);
+        } else {
+            owner.getPtr()->descriptor.slot[slot] = branch.getPtr()->offset | SLOT_IN_USE;
+            updateIndexDescriptor(owner);
+            releaseNode(prefix.getPtr()->offset, sizeof(PREFIX_DESCRIPTOR));
+        }
+        
+        return branch;
+    }
+
+    Ref<IndexedDataStore::LOADED_PREFIX_DESCRIPTOR> IndexedDataStore::loadPrefixDescriptor(unsigned long long offset) {
+        LOADED_PREFIX_DESCRIPTOR *prefix = new LOADED_PREFIX_DESCRIPTOR;
+        readDescriptor(offset, &prefix->descriptor, sizeof(PREFIX_DESCRIPTOR));
+        
+        if (prefix->descriptor.magic_flag != MAGIC_FLAG_PREFIX || prefix->descriptor.length > PREFIX_SEGMENT_SIZE) {
+            delete prefix;
+            throw "Invalid prefix descriptor";
+        }
+        
+        prefix->offset = offset;
+        
+        return Ref<LOADED_PREFIX_DESCRIPTOR>(prefix);
+    }
+
+    Ref<IndexedDataStore::LOADED_PREFIX_DESCRIPTOR> IndexedDataStore::createPrefixDescriptor(const unsigned char *segment, size_t length, unsigned long long next) {
+        LOADED_PREFIX_DESCRIPTOR *prefix = new LOADED_PREFIX_DESCRIPTOR;
+        memset(&prefix->descriptor, 0, sizeof(PREFIX_DESCRIPTOR));
+        prefix->descriptor.magic_flag = MAGIC_FLAG_PREFIX;
+        prefix->descriptor.next_index_descriptor = next;
+        prefix->descriptor.length = (unsigned char)length;
+        memcpy(prefix->descriptor.segment, segment, length);
+        prefix->offset = allocateNode(sizeof(PREFIX_DESCRIPTOR));
         
+        Ref<LOADED_PREFIX_DESCRIPTOR> ret(prefix);
+        updatePrefixDescriptor(ret);
+        return ret;
+    }
+
+    void IndexedDataStore::updatePrefixDescriptor(Ref<LOADED_PREFIX_DESCRIPTOR> prefix) {
+        writeDescriptor(prefix.getPtr()->offset, &prefix.getPtr()->descriptor, sizeof(PREFIX_DESCRIPTOR));
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::loadIndexDescriptor(unsigned long long offset) {
         LOADED_INDEX_DESCRIPTOR *desc = new LOADED_INDEX_DESCRIPTOR;
-        memcpy(&desc->descriptor, mem.operator char *(), sizeof(INDEX_DESCRIPTOR));
+        readIndexNode(offset, &desc->descriptor);
         
-        if (desc->descriptor.magic_flag != MAGIC_FLAG_INDEX)
+        if (desc->descriptor.magic_flag != MAGIC_FLAG_INDEX) {
+            delete desc;
             throw "Invalid index descriptor";
+        }
         
         desc->offset = offset;
         
@@ -401,91 +1232,323 @@ namespace nrcore {
     }
 
     Ref<IndexedDataStore::LOADED_BANK_MAP> IndexedDataStore::loadBankMap(unsigned long long offset) {
-        Memory mem = file.read(offset, sizeof(BANK_MAP));
-
         LOADED_BANK_MAP *bmap = new LOADED_BANK_MAP;
-        memcpy(&bmap->descriptor, mem.operator char *(), sizeof(BANK_MAP));
+        readBankNode(offset, &bmap->descriptor);
         bmap->offset = offset;
 
-        if (bmap->descriptor.magic_flag != MAGIC_FLAG_BANK_MAP)
+        if (bmap->descriptor.magic_flag != MAGIC_FLAG_BANK_MAP) {
+            delete bmap;
             throw "Invalid bank map";
+        }
 
         return Ref<LOADED_BANK_MAP>(bmap);
     }
 
-    bool IndexedDataStore::convertDescriptorListToBankMap(Memory key) {
-        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = getUserDecriptor();
+    void IndexedDataStore::createBankMap(Ref<LOADED_INDEX_DESCRIPTOR> head) {
+        // The map is written before any descriptor is relinked to it, so the chain stays usable until the last update
+        LOADED_BANK_MAP *bmap = new LOADED_BANK_MAP;
+        memset(&bmap->descriptor, 0, sizeof(BANK_MAP));
+        bmap->descriptor.magic_flag = MAGIC_FLAG_BANK_MAP;
+        bmap->offset = allocateNode(bankNodeSize());
+        Ref<LOADED_BANK_MAP> ret(bmap);
         
-        for (int i=0; i<key.length(); i++) {
-            desc = getChildDescriptor(desc, (unsigned char)(key.getPtr()[i]&0xFF), false);
-            if (!desc.getPtr())
-                throw "Failed to get file key";
+        std::vector< Ref<LOADED_INDEX_DESCRIPTOR> > chain;
+        Ref<LOADED_INDEX_DESCRIPTOR> desc = head;
+        while (true) {
+            chain.push_back(desc);
+            bmap->descriptor.banks[desc.getPtr()->descriptor.range_start/BANK_SIZE] = desc.getPtr()->offset;
+            if (!desc.getPtr()->descriptor.next_index_descriptor)
+                break;
+            desc = loadIndexDescriptor(desc.getPtr()->descriptor.next_index_descriptor);
         }
+        updateBankMap(ret);
+        
+        for (size_t i=chain.size(); i>0; i--) {
+            chain[i-1].getPtr()->descriptor.next_index_descriptor = bmap->offset | NEXT_BANK_MAP;
+            updateIndexDescriptor(chain[i-1]);
+        }
+    }
 
-        if (desc.getPtr()->descriptor.range_start == 0) { // We will only convert a descriptor list to a bank map if we have a lowest possible descriptor
-            Memory mem(sizeof(BANK_MAP));
-            BANK_MAP *bmap = (BANK_MAP*)mem.operator char *();
-            memset(&bmap, 0, sizeof(BANK_MAP));
-            bmap->magic_flag = MAGIC_FLAG_BANK_MAP;
-
-            Ref<LOADED_INDEX_DESCRIPTOR> next;
-
-            unsigned long long file_offset = file.length();
-
-            if (!(desc.getPtr()->descriptor.next_index_descriptor && 0x8000000000000000)) {
-                desc.getPtr()->descriptor.next_index_descriptor = file_offset | 0x8000000000000000;
-                updateIndexDescriptor(desc);
-
-                bmap->banks[0] = desc.getPtr()->offset;
-                while (desc.getPtr()->descriptor.next_index_descriptor) {
-                    next = loadIndexDescriptor(desc.getPtr()->descriptor.next_index_descriptor);
-                    int bank_slot = next.getPtr()->descriptor.range_start/BANK_SIZE;
-                    bmap->banks[bank_slot] = next.getPtr()->offset;
+    void IndexedDataStore::updateBankMap(Ref<LOADED_BANK_MAP> bmap) {
+        writeBankNode(bmap.getPtr()->offset, &bmap.getPtr()->descriptor);
+    }
 
-                    next.getPtr()->descriptor.next_index_descriptor = file_offset | 0x8000000000000000;
-                    updateIndexDescriptor(next);
-                }
+    unsigned int IndexedDataStore::getFormatVersion() {
+        ReadWriteLock::Reader reader(lock);
+        return format_version;
+    }
 
-                this->file.write(file_offset, mem.operator char *(), sizeof(BANK_MAP));
+    bool IndexedDataStore::upgradeFormat() {
+        ReadWriteLock::Writer writer(lock);
+        if (format_version >= STORE_FORMAT_VERSION)
+            return false;
+        
+        if (batch_depth)
+            throw "Cannot upgrade the store format during a batch";
+        
+        INDEX_DESCRIPTOR root;
+        readDescriptor(0, &root, sizeof(INDEX_DESCRIPTOR));
+        if (root.magic_flag != MAGIC_FLAG_INDEX)
+            throw "Invalid index descriptor";
+        
+        // Old nodes are read with their own layout while the copies are allocated and written in the new one
+        std::vector< std::pair<unsigned long long, size_t> > released;
+        unsigned long long new_root;
+        format_version = STORE_FORMAT_VERSION;
+        try {
+            root.slot[0] = upgradeIndexNode(root.slot[0] & SLOT_OFFSET_MASK, released) | SLOT_IN_USE;
+            root.slot[1] = upgradeIndexNode(root.slot[1] & SLOT_OFFSET_MASK, released) | SLOT_IN_USE;
+            new_root = allocateNode(indexNodeSize());
+            writeIndexNode(new_root, &root);
+            file.sync();
+        } catch (...) {
+            format_version = 1;
+            node_extent = 0;
+            node_next = 0;
+            throw;
+        }
+        
+        // Up to here the store is still a complete version 1 store with some unused space at its end
+        root_offset = new_root;
+        writeSuperblock(node_next);
+        file.sync();
+        cache.clear();
+        
+        // The old root lies under the superblock, the rest of the old index is cut into aligned nodes of the new sizes.
+        // Old nodes allocated one after another are joined first, so most of the space comes back as whole index nodes.
+        std::sort(released.begin(), released.end());
+        for (size_t i=0; i<released.size();) {
+            unsigned long long start = released[i].first;
+            unsigned long long end = start+released[i].second;
+            for (i++; i<released.size() && released[i].first == end; i++)
+                end += released[i].second;
+            
+            unsigned long long offset = start+(NODE_ALIGN-start%NODE_ALIGN)%NODE_ALIGN;
+            for (; offset+indexNodeSize() <= end; offset+=indexNodeSize())
+                releaseNode(offset, indexNodeSize());
+            for (; offset+sizeof(PREFIX_DESCRIPTOR) <= end; offset+=sizeof(PREFIX_DESCRIPTOR))
+                releaseNode(offset, sizeof(PREFIX_DESCRIPTOR));
+        }
+        
+        return true;
+    }
 
-                return true;
+    unsigned long long IndexedDataStore::upgradeIndexNode(unsigned long long offset, std::vector< std::pair<unsigned long long, size_t> > &released) {
+        // Children are copied before the nodes linking to them, so each node is written once its links are known
+        std::vector<INDEX_DESCRIPTOR> chain(1);
+        readDescriptor(offset, &chain[0], sizeof(INDEX_DESCRIPTOR));
+        if (chain[0].magic_flag != MAGIC_FLAG_INDEX)
+            throw "Invalid index descriptor";
+        released.push_back(std::make_pair(offset, sizeof(INDEX_DESCRIPTOR)));
+        
+        bool banked = (chain[0].next_index_descriptor & NEXT_BANK_MAP) != 0;
+        if (banked) {
+            BANK_MAP bmap;
+            unsigned long long map_offset = chain[0].next_index_descriptor & ~NEXT_BANK_MAP;
+            readDescriptor(map_offset, &bmap, sizeof(BANK_MAP));
+            if (bmap.magic_flag != MAGIC_FLAG_BANK_MAP)
+                throw "Invalid bank map";
+            released.push_back(std::make_pair(map_offset, sizeof(BANK_MAP)));
+            
+            for (int b=0; b<256/BANK_SIZE; b++) {
+                if (!bmap.banks[b] || bmap.banks[b] == offset)
+                    continue;
+                
+                chain.resize(chain.size()+1);
+                readDescriptor(bmap.banks[b], &chain.back(), sizeof(INDEX_DESCRIPTOR));
+                released.push_back(std::make_pair(bmap.banks[b], sizeof(INDEX_DESCRIPTOR)));
+            }
+        } else {
+            while (chain.back().next_index_descriptor) {
+                unsigned long long next = chain.back().next_index_descriptor;
+                chain.resize(chain.size()+1);
+                readDescriptor(next, &chain.back(), sizeof(INDEX_DESCRIPTOR));
+                released.push_back(std::make_pair(next, sizeof(INDEX_DESCRIPTOR)));
+            }
+        }
+        
+        for (size_t i=0; i<chain.size(); i++) {
+            if (chain[i].magic_flag != MAGIC_FLAG_INDEX)
+                throw "Invalid index descriptor";
+            
+            for (int j=0; j<BANK_SIZE; j++) {
+                unsigned long long slot = chain[i].slot[j];
+                if (!(slot & SLOT_IN_USE))
+                    continue;
+                
+                unsigned long long child = slot & SLOT_PREFIX ? upgradePrefixNode(slot & SLOT_OFFSET_MASK, released) : upgradeIndexNode(slot & SLOT_OFFSET_MASK, released);
+                chain[i].slot[j] = child | (slot & ~SLOT_OFFSET_MASK);
             }
         }
+        
+        if (!banked) {
+            // Last sibling first, each one links to the copy written before it
+            unsigned long long next = 0;
+            for (size_t i=chain.size(); i>0; i--) {
+                chain[i-1].next_index_descriptor = next;
+                next = allocateNode(indexNodeSize());
+                writeIndexNode(next, &chain[i-1]);
+            }
+            return next;
+        }
+        
+        // Banks are written unlinked, then the map, then the banks again with their link to the map
+        std::vector<unsigned long long> copies(chain.size());
+        for (size_t i=0; i<chain.size(); i++) {
+            chain[i].next_index_descriptor = 0;
+            copies[i] = allocateNode(indexNodeSize());
+            writeIndexNode(copies[i], &chain[i]);
+        }
+        
+        BANK_MAP bmap;
+        memset(&bmap, 0, sizeof(BANK_MAP));
+        bmap.magic_flag = MAGIC_FLAG_BANK_MAP;
+        for (size_t i=0; i<chain.size(); i++)
+            bmap.banks[chain[i].range_start/BANK_SIZE] = copies[i];
+        
+        unsigned long long map_offset = allocateNode(bankNodeSize());
+        writeBankNode(map_offset, &bmap);
+        
+        for (size_t i=0; i<chain.size(); i++) {
+            chain[i].next_index_descriptor = map_offset | NEXT_BANK_MAP;
+            writeIndexNode(copies[i], &chain[i]);
+        }
+        
+        return copies[0];
+    }
 
-        return false;
+    unsigned long long IndexedDataStore::upgradePrefixNode(unsigned long long offset, std::vector< std::pair<unsigned long long, size_t> > &released) {
+        PREFIX_DESCRIPTOR prefix;
+        readDescriptor(offset, &prefix, sizeof(PREFIX_DESCRIPTOR));
+        if (prefix.magic_flag != MAGIC_FLAG_PREFIX || prefix.length > PREFIX_SEGMENT_SIZE)
+            throw "Invalid prefix descriptor";
+        released.push_back(std::make_pair(offset, sizeof(PREFIX_DESCRIPTOR)));
+        
+        // Same layout in both versions, only the placement and the link to the index node change
+        prefix.next_index_descriptor = upgradeIndexNode(prefix.next_index_descriptor, released);
+        unsigned long long copy = allocateNode(sizeof(PREFIX_DESCRIPTOR));
+        writeDescriptor(copy, &prefix, sizeof(PREFIX_DESCRIPTOR));
+        
+        return copy;
+    }
+
+    bool IndexedDataStore::convertDescriptorListToBankMap(Memory key) {
+        ReadWriteLock::Writer writer(lock);
+        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, false);
+        if (!desc.getPtr())
+            throw "Failed to get file key";
+
+        // Only the head of a node starts at 0, a bank map is always reached from there
+        if (desc.getPtr()->descriptor.range_start != 0 || (desc.getPtr()->descriptor.next_index_descriptor & NEXT_BANK_MAP))
+            return false;
+        
+        createBankMap(desc);
+        
+        return true;
     }
 
     Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::loadFileDescriptor(unsigned long long offset) {
-        Memory mem = file.read(offset, sizeof(INDEX_DESCRIPTOR));
+        Ref<LOADED_FILE_DESCRIPTOR> ret(new LOADED_FILE_DESCRIPTOR);
+        readFileDescriptor(offset, &ret.getPtr()->descriptor);
+        ret.getPtr()->offset = offset;
         
-        LOADED_FILE_DESCRIPTOR *desc = new LOADED_FILE_DESCRIPTOR;
-        memcpy(&desc->descriptor, mem.operator char *(), sizeof(FILE_DESCRIPTOR));
+        return ret;
+    }
+
+    void IndexedDataStore::readFileDescriptor(unsigned long long offset, FILE_DESCRIPTOR *descriptor) {
+        readDescriptor(offset, descriptor, sizeof(FILE_DESCRIPTOR));
         
-        if (desc->descriptor.magic_flag != MAGIC_FLAG_FILE)
+        if (descriptor->magic_flag == MAGIC_FLAG_FILE) {
+            // Legacy descriptors are followed by unrelated data
+            memset((char*)descriptor + LEGACY_FILE_DESCRIPTOR_SIZE, 0, sizeof(FILE_DESCRIPTOR) - LEGACY_FILE_DESCRIPTOR_SIZE);
+            descriptor->block_count = 0;
+        } else if (descriptor->magic_flag != MAGIC_FLAG_INDEXED_FILE && descriptor->magic_flag != MAGIC_FLAG_VALUE_FILE)
             throw "Invalid file descriptor";
+    }
+
+    unsigned long long IndexedDataStore::createValueFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, Memory value) {
+        return createValueFile(desc, value.operator char *(), value.length());
+    }
+
+    unsigned long long IndexedDataStore::createValueFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, const char *data, size_t length) {
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.bytes_written, length);
         
-        desc->offset = offset;
+        VALUE_RECORD record;
+        memset(&record, 0, sizeof(VALUE_RECORD));
+        record.descriptor.magic_flag = MAGIC_FLAG_VALUE_FILE;
+        record.descriptor.block_size = length ? (unsigned int)length : INLINE_VALUE_SIZE;
+        record.descriptor.file_size = length;
+        memcpy(record.data, data, length);
+        
+        unsigned long long offset = allocate(sizeof(VALUE_RECORD));
+        writeDescriptor(offset, &record, sizeof(VALUE_RECORD));
         
-        return Ref<LOADED_FILE_DESCRIPTOR>(desc);
+        desc.getPtr()->descriptor.file = offset;
+        updateIndexDescriptor(desc);
+        
+        return offset;
     }
 
-    Ref<IndexedDataStore::LOADED_DATA_BLOCK_DESCRIPTOR> IndexedDataStore::loadDataDescriptor(unsigned long long offset) {
-        Memory mem = file.read(offset, sizeof(DATA_BLOCK_DESCRIPTOR));
+    void IndexedDataStore::writeValueFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length) {
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        VALUE_RECORD record;
         
+        // The record only has to be read when part of the current value survives the write
+        if (offset || length < fd->file_size)
+            readDescriptor(file.getPtr()->offset, &record, sizeof(VALUE_RECORD));
+        else
+            memset(&record, 0, sizeof(VALUE_RECORD));
+        
+        if (offset > fd->file_size)
+            memset(record.data+fd->file_size, 0, (size_t)(offset-fd->file_size));
+        if (offset+length > fd->file_size)
+            fd->file_size = offset+length;
+        
+        record.descriptor = *fd;
+        memcpy(record.data+offset, data, (size_t)length);
+        writeDescriptor(file.getPtr()->offset, &record, sizeof(VALUE_RECORD));
+    }
+
+    void IndexedDataStore::convertValueFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        // The descriptor stays where it is so the key does not have to be updated, the value moves to a data block
+        VALUE_RECORD record;
+        readDescriptor(file.getPtr()->offset, &record, sizeof(VALUE_RECORD));
+        
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        unsigned long long size = fd->file_size;
+        
+        fd->magic_flag = MAGIC_FLAG_INDEXED_FILE;
+        fd->flags |= FILE_FLAG_VALUE_RECORD;
+        fd->file_size = 0;
+        fd->first_data_block = 0;
+        fd->last_data_block = 0;
+        fd->block_count = 0;
+        fd->block_index = 0;
+        updateFileDescriptor(file);
+        
+        if (size)
+            writeToFile(file, Memory(record.data, (size_t)size), 0, size);
+    }
+
+    Ref<IndexedDataStore::LOADED_DATA_BLOCK_DESCRIPTOR> IndexedDataStore::loadDataDescriptor(unsigned long long offset) {
         LOADED_DATA_BLOCK_DESCRIPTOR *desc = new LOADED_DATA_BLOCK_DESCRIPTOR;
-        memcpy(&desc->descriptor, mem.operator char *(), sizeof(DATA_BLOCK_DESCRIPTOR));
+        readDescriptor(offset, &desc->descriptor, sizeof(DATA_BLOCK_DESCRIPTOR));
         
-        if (desc->descriptor.magic_flag != MAGIC_FLAG_DATA)
+        if (desc->descriptor.magic_flag != MAGIC_FLAG_DATA) {
+            delete desc;
             throw "Invalid data descriptor";
+        }
         
         desc->offset = offset;
-        desc->data = file.read(offset+sizeof(DATA_BLOCK_DESCRIPTOR), desc->descriptor.block_size);
+        desc->data = Memory(desc->descriptor.block_size);
+        readData(offset+sizeof(DATA_BLOCK_DESCRIPTOR), desc->data.operator char *(), desc->descriptor.block_size);
         
         return Ref<LOADED_DATA_BLOCK_DESCRIPTOR>(desc);
     }
 
     void IndexedDataStore::updateIndexDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor) {
-        file.write(descriptor.getPtr()->offset, (const char*)&descriptor.getPtr()->descriptor, sizeof(INDEX_DESCRIPTOR));
+        writeIndexNode(descriptor.getPtr()->offset, &descriptor.getPtr()->descriptor);
     }
 
     Ref<IndexedDataStore::LOADED_DATA_BLOCK_DESCRIPTOR> IndexedDataStore::createDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file_desc, Ref<LOADED_DATA_BLOCK_DESCRIPTOR> previous) {
@@ -494,81 +1557,1381 @@ namespace nrcore {
         desc.magic_flag = MAGIC_FLAG_DATA;
         desc.block_size = file_desc.getPtr()->descriptor.block_size;
         
-        unsigned long long file_offset = file.length();
-        file.write(file_offset, (const char*)&desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+        // The recycled blocks file is written while the free lists are being updated, so it always extends the store
+        bool recycle = file_desc.getPtr()->offset != recycled_blocks.getPtr()->offset;
+        unsigned long long file_offset = allocate(sizeof(DATA_BLOCK_DESCRIPTOR)+desc.block_size, recycle);
         
-        Memory mem(desc.block_size);
-        for (int i=0; i<desc.block_size; i++) {
-            mem.getPtr()[i] = 0;
-        }
-        this->file.write(file_offset+sizeof(DATA_BLOCK_DESCRIPTOR), mem.operator char *(), desc.block_size);
+        // The data is only written once something is written to the block, new space is reserved as a hole.
+        // Recycled space keeps its old contents past used_bytes, which nothing reads.
+        if (file_offset >= storeLength())
+            reserveRaw(file_offset+sizeof(DATA_BLOCK_DESCRIPTOR)+desc.block_size);
+        writeDescriptor(file_offset, &desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+        
+        if (previous.getPtr()) {
+            previous.getPtr()->descriptor.next_data_block = file_offset;
+            updateDataBlockDescriptor(previous);
+        } else
+            file_desc.getPtr()->descriptor.first_data_block = file_offset;
         
-        previous.getPtr()->descriptor.next_data_block = file_offset;
         file_desc.getPtr()->descriptor.last_data_block = file_offset;
-        updateDataBlockDescriptor(previous);
+        
+        if (isIndexedFile(file_desc)) {
+            indexDataBlocks(file_desc, file_desc.getPtr()->descriptor.block_count, &file_offset, 1);
+            file_desc.getPtr()->descriptor.block_count++;
+        }
+        
         updateFileDescriptor(file_desc);
         
-        return loadDataDescriptor(file_offset);
-    }
+        LOADED_DATA_BLOCK_DESCRIPTOR *block = new LOADED_DATA_BLOCK_DESCRIPTOR;
+        block->offset = file_offset;
+        block->descriptor = desc;
+        block->data = Memory(desc.block_size);
+        memset(block->data.operator char *(), 0, desc.block_size);
         
-    void IndexedDataStore::updateFileDescriptor(Ref<LOADED_FILE_DESCRIPTOR> descriptor) {
-        file.write(descriptor.getPtr()->offset, (const char*)&descriptor.getPtr()->descriptor, sizeof(FILE_DESCRIPTOR));
+        return Ref<LOADED_DATA_BLOCK_DESCRIPTOR>(block);
     }
 
-    void IndexedDataStore::updateDataBlockDescriptor(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor) {
-        file.write(descriptor.getPtr()->offset, (const char*)&descriptor.getPtr()->descriptor, sizeof(DATA_BLOCK_DESCRIPTOR));
+    void IndexedDataStore::appendDataBlocks(Ref<LOADED_FILE_DESCRIPTOR> file_desc, Ref<LOADED_DATA_BLOCK_DESCRIPTOR> previous, const char *data, unsigned long long length) {
+        // The blocks are laid out back to back at the end of the store, already chained, and written out in large runs
+        unsigned int block_size = file_desc.getPtr()->descriptor.block_size;
+        unsigned long long stride = sizeof(DATA_BLOCK_DESCRIPTOR)+block_size;
+        unsigned long long count = (length+block_size-1)/block_size;
+        unsigned long long extent = storeLength();
+        
+        std::vector<unsigned long long> blocks(count);
+        for (unsigned long long block=0; block<count; block++)
+            blocks[block] = extent+block*stride;
+        
+        if (!data) {
+            // Hole blocks are reserved in one go and only their descriptors written, the data reads back as zeros
+            reserveRaw(extent+count*stride);
+            
+            for (unsigned long long block=0; block<count; block++) {
+                DATA_BLOCK_DESCRIPTOR desc;
+                memset(&desc, 0, sizeof(DATA_BLOCK_DESCRIPTOR));
+                desc.magic_flag = MAGIC_FLAG_DATA;
+                desc.next_data_block = block+1 < count ? blocks[block+1] : 0;
+                desc.block_size = block_size;
+                desc.used_bytes = (unsigned int)(length-block*block_size < block_size ? length-block*block_size : block_size);
+                writeRaw(blocks[block], (const char*)&desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+            }
+        } else {
+            unsigned long long run = EXTENT_WRITE_SIZE/stride;
+            if (!run)
+                run = 1;
+            if (run > count)
+                run = count;
+            
+            Memory buffer(run*stride);
+            for (unsigned long long first=0; first<count; first+=run) {
+                unsigned long long n = count-first < run ? count-first : run;
+                memset(buffer.operator char *(), 0, n*stride);
+                
+                for (unsigned long long i=0; i<n; i++) {
+                    unsigned long long block = first+i;
+                    unsigned long long used = length-block*block_size < block_size ? length-block*block_size : block_size;
+                    
+                    DATA_BLOCK_DESCRIPTOR *desc = (DATA_BLOCK_DESCRIPTOR*)(buffer.operator char *()+i*stride);
+                    desc->magic_flag = MAGIC_FLAG_DATA;
+                    desc->next_data_block = block+1 < count ? blocks[block+1] : 0;
+                    desc->block_size = block_size;
+                    desc->used_bytes = (unsigned int)used;
+                    memcpy((char*)desc+sizeof(DATA_BLOCK_DESCRIPTOR), data+block*block_size, used);
+                }
+                
+                writeRaw(extent+first*stride, buffer.operator char *(), n*stride);
+            }
+        }
+        
+        if (previous.getPtr()) {
+            previous.getPtr()->descriptor.next_data_block = extent;
+            updateDataBlockDescriptor(previous);
+        } else
+            file_desc.getPtr()->descriptor.first_data_block = extent;
+        
+        file_desc.getPtr()->descriptor.last_data_block = blocks[count-1];
+        
+        if (isIndexedFile(file_desc)) {
+            indexDataBlocks(file_desc, file_desc.getPtr()->descriptor.block_count, &blocks[0], (unsigned int)count);
+            file_desc.getPtr()->descriptor.block_count += (unsigned int)count;
+        }
+        
+        updateFileDescriptor(file_desc);
     }
 
-    void IndexedDataStore::updateDataBlockData(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor) {
-        unsigned long long offset = descriptor.getPtr()->offset+sizeof(DATA_BLOCK_DESCRIPTOR);
-        int len = descriptor.getPtr()->descriptor.block_size;
+    void IndexedDataStore::extendFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long size) {
+        // Grows the file to size with zeros, the last block is filled out and whole blocks past it are holes
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        unsigned int block_size = fd->block_size;
+        
+        if (isCompressedFile(file)) {
+            // Blocks of zeros compress to next to nothing, so the gap is simply written
+            Memory zeros(block_size);
+            memset(zeros.operator char *(), 0, block_size);
+            while (fd->file_size < size) {
+                unsigned long long len = block_size-fd->file_size%block_size;
+                if (len > size-fd->file_size)
+                    len = size-fd->file_size;
+                writeCompressedFile(file, zeros.operator char *(), fd->file_size, len);
+            }
+            return;
+        }
         
-        file.write(offset, descriptor.getPtr()->data.operator char *(), len);
+        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> last;
+        if (fd->last_data_block) {
+            last = loadDataDescriptor(fd->last_data_block);
+            DATA_BLOCK_DESCRIPTOR *desc = &last.getPtr()->descriptor;
+            
+            if (desc->used_bytes < block_size) {
+                unsigned long long fill = block_size-desc->used_bytes;
+                if (fill > size-fd->file_size)
+                    fill = size-fd->file_size;
+                
+                memset(last.getPtr()->data.operator char *()+desc->used_bytes, 0, (size_t)fill);
+                markDataBlockDirty(last, desc->used_bytes, desc->used_bytes+(unsigned int)fill);
+                desc->used_bytes += (unsigned int)fill;
+                fd->file_size += fill;
+                updateDataBlockData(last, true);
+            }
+        }
+        
+        if (fd->file_size < size) {
+            appendDataBlocks(file, last, 0, size-fd->file_size);
+            fd->file_size = size;
+        }
+        
+        updateFileDescriptor(file);
     }
 
-    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getRootDecriptor() {
-        return loadIndexDescriptor(0);
+    Ref<IndexedDataStore::LOADED_DATA_BLOCK_DESCRIPTOR> IndexedDataStore::seekDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long *block_offset, bool create) {
+        unsigned int block_size = file.getPtr()->descriptor.block_size;
+        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> desc;
+        
+        if (isIndexedFile(file)) {
+            unsigned long long block_number = offset/block_size;
+            *block_offset = block_number*block_size;
+            
+            if (block_number < file.getPtr()->descriptor.block_count)
+                return loadDataDescriptor(getDataBlockOffset(file, (unsigned int)block_number));
+            
+            // Only reachable when appending whole blocks
+            if (create)
+                return createDataBlock(file, loadDataDescriptor(file.getPtr()->descriptor.last_data_block));
+            
+            return desc;
+        }
+        
+        // Chained files have to walk the data blocks to find the one where offset resides
+        desc = loadDataDescriptor(file.getPtr()->descriptor.first_data_block);
+        *block_offset = 0;
+        
+        if (create && offset == getFileSize(file) && offset%block_size == 0) {
+            // Just jumping to the last block will work when appending whole blocks
+            *block_offset = offset;
+            desc = loadDataDescriptor(file.getPtr()->descriptor.last_data_block);
+            if (offset)
+                desc = createDataBlock(file, desc);
+            return desc;
+        }
+        
+        while(desc.getPtr() && desc.getPtr()->descriptor.used_bytes == desc.getPtr()->descriptor.block_size && (desc.getPtr()->descriptor.used_bytes+*block_offset) <= offset) {
+            if (desc.getPtr()->descriptor.next_data_block) {
+                STATS_COUNT(stats.chain_hops, 1);
+                desc = loadDataDescriptor(desc.getPtr()->descriptor.next_data_block);
+            } else if (create) {
+                desc = createDataBlock(file, desc);
+            } else
+                return Ref<LOADED_DATA_BLOCK_DESCRIPTOR>();
+            *block_offset += block_size;
+        }
+        
+        return desc;
     }
-
-    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getSystemDecriptor() {
-        Ref<LOADED_INDEX_DESCRIPTOR> root = getRootDecriptor();
-        return loadIndexDescriptor(root.getPtr()->descriptor.slot[0]);
+        
+    void IndexedDataStore::updateFileDescriptor(Ref<LOADED_FILE_DESCRIPTOR> descriptor) {
+        size_t len = isLegacyFile(descriptor) ? LEGACY_FILE_DESCRIPTOR_SIZE : sizeof(FILE_DESCRIPTOR);
+        writeRaw(descriptor.getPtr()->offset, (const char*)&descriptor.getPtr()->descriptor, len);
+        cache.put(descriptor.getPtr()->offset, &descriptor.getPtr()->descriptor, sizeof(FILE_DESCRIPTOR));
     }
 
-    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getUserDecriptor() {
-        Ref<LOADED_INDEX_DESCRIPTOR> root = getRootDecriptor();
-        return loadIndexDescriptor(root.getPtr()->descriptor.slot[1]);
+    bool IndexedDataStore::isIndexedFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        return file.getPtr()->descriptor.magic_flag == MAGIC_FLAG_INDEXED_FILE;
     }
 
-    RefArray<int> IndexedDataStore::getChildIndexes(Memory key) {
-        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = getUserDecriptor();
-        for (int i=0; i<key.length(); i++) {
-            desc = getChildDescriptor(desc, (unsigned char)(key.getPtr()[i]&0xFF), false);
-            if (!desc.getPtr())
-                throw "Failed to get file key";
-        }
-
-        Array<int> list;
+    bool IndexedDataStore::isValueFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        return file.getPtr()->descriptor.magic_flag == MAGIC_FLAG_VALUE_FILE;
+    }
 
-        while (true) {
-            for (int i=0; i<16; i++) {
-                if (desc.getPtr()->descriptor.slot[i] & 0x8000000000000000) 
-                    list.push(i);
+    bool IndexedDataStore::isLegacyFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        return file.getPtr()->descriptor.magic_flag == MAGIC_FLAG_FILE;
+    }
 
-                if (desc.getPtr()->descriptor.next_index_descriptor)
-                    desc = loadIndexDescriptor(desc.getPtr()->descriptor.next_index_descriptor);
-                else 
-                    break;
-            }
-        }
+    bool IndexedDataStore::isCompressedFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        return isIndexedFile(file) && (file.getPtr()->descriptor.flags & FILE_FLAG_COMPRESSED);
+    }
 
-        int len = list.length();
-        int *ret = new int[len];
-        for (int i=0; i<len; i++) {
-            ret[i] = list.get(i);
+    void IndexedDataStore::upgradeFileDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> owner, Ref<LOADED_FILE_DESCRIPTOR> file_desc) {
+        // Chained files are moved to a full size descriptor, the block index is built from a single walk of the chain
+        Array<unsigned long long> blocks;
+        unsigned long long offset = file_desc.getPtr()->descriptor.first_data_block;
+        while (offset) {
+            blocks.push(offset);
+            offset = loadDataDescriptor(offset).getPtr()->descriptor.next_data_block;
         }
-
+        
+        unsigned int count = blocks.length();
+        unsigned long long *block_offsets = new unsigned long long[count ? count : 1];
+        for (unsigned int i=0; i<count; i++)
+            block_offsets[i] = blocks.get(i);
+        
+        unsigned long long old_offset = file_desc.getPtr()->offset;
+        file_desc.getPtr()->descriptor.magic_flag = MAGIC_FLAG_INDEXED_FILE;
+        file_desc.getPtr()->descriptor.block_count = 0;
+        file_desc.getPtr()->descriptor.block_index = 0;
+        file_desc.getPtr()->offset = allocate(sizeof(FILE_DESCRIPTOR));
+        writeDescriptor(file_desc.getPtr()->offset, &file_desc.getPtr()->descriptor, sizeof(FILE_DESCRIPTOR));
+        
+        indexDataBlocks(file_desc, 0, block_offsets, count);
+        file_desc.getPtr()->descriptor.block_count = count;
+        updateFileDescriptor(file_desc);
+        delete[] block_offsets;
+        
+        owner.getPtr()->descriptor.file = file_desc.getPtr()->offset;
+        updateIndexDescriptor(owner);
+        
+        // Readers may still hold the old descriptor, their writes are redirected by resolveFile
+        upgraded_files[old_offset] = file_desc.getPtr()->offset;
+        release(old_offset, LEGACY_FILE_DESCRIPTOR_SIZE);
+    }
+
+    void IndexedDataStore::resolveFile(Ref<LOADED_FILE_DESCRIPTOR> file) {
+        if (!isLegacyFile(file))
+            return;
+        
+        std::unordered_map<unsigned long long, unsigned long long>::iterator it = upgraded_files.find(file.getPtr()->offset);
+        if (it == upgraded_files.end())
+            return;
+        
+        // A rolled back upgrade leaves the legacy descriptor in place
+        uint32_t magic;
+        readData(file.getPtr()->offset, (char*)&magic, sizeof(magic));
+        if (magic == MAGIC_FLAG_FILE) {
+            upgraded_files.erase(it);
+            return;
+        }
+        
+        Ref<LOADED_FILE_DESCRIPTOR> moved = loadFileDescriptor(it->second);
+        file.getPtr()->offset = moved.getPtr()->offset;
+        file.getPtr()->descriptor = moved.getPtr()->descriptor;
+    }
+
+    bool IndexedDataStore::writeCompressedFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length) {
+        // Every block touched is decoded, patched and stored again whole
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        unsigned int block_size = fd->block_size;
+        Memory block(block_size);
+        unsigned long long written = 0;
+        
+        while (written < length) {
+            unsigned int block_number = (unsigned int)((offset+written)/block_size);
+            unsigned int cursor = (unsigned int)((offset+written)%block_size);
+            unsigned long long len = block_size-cursor;
+            if (len > length-written)
+                len = length-written;
+            
+            unsigned int used = 0;
+            if (block_number < fd->block_count && len < block_size) {
+                DATA_BLOCK_DESCRIPTOR desc;
+                unsigned long long position = getDataBlockOffset(file, block_number);
+                readDescriptor(position, &desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+                readBlockData(file, position, &desc, block.operator char *());
+                used = desc.used_bytes;
+            }
+            
+            memcpy(block.operator char *()+cursor, data+written, (size_t)len);
+            if (cursor+len > used)
+                used = (unsigned int)(cursor+len);
+            
+            storeCompressedBlock(file, block_number, block.operator char *(), used);
+            written += len;
+        }
+        
+        if (offset+length > fd->file_size) {
+            fd->file_size = offset+length;
+            updateFileDescriptor(file);
+        }
+        
+        return true;
+    }
+
+    unsigned long long IndexedDataStore::storeCompressedBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned int block_number, const char *data, unsigned int used) {
+        // Replaces block_number, or appends it when it is one past the last block, and returns where it was stored
+        FILE_DESCRIPTOR *fd = &file.getPtr()->descriptor;
+        Memory packed(fd->block_size);
+        
+        size_t length = BlockCodec::compress(data, used, packed.operator char *(), fd->block_size);
+        unsigned int physical = (unsigned int)((length+COMPRESSED_BLOCK_ALIGN-1)/COMPRESSED_BLOCK_ALIGN*COMPRESSED_BLOCK_ALIGN);
+        const char *payload = packed.operator char *();
+        if (!length || physical >= fd->block_size) {
+            physical = fd->block_size;
+            length = used;
+            payload = data;
+        }
+        
+        DATA_BLOCK_DESCRIPTOR desc;
+        memset(&desc, 0, sizeof(DATA_BLOCK_DESCRIPTOR));
+        unsigned long long position = 0;
+        
+        if (block_number < fd->block_count) {
+            position = getDataBlockOffset(file, block_number);
+            readDescriptor(position, &desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+        }
+        
+        bool moved = !position || desc.block_size != physical;
+        if (moved) {
+            if (position)
+                release(position, sizeof(DATA_BLOCK_DESCRIPTOR)+desc.block_size);
+            position = allocate(sizeof(DATA_BLOCK_DESCRIPTOR)+physical);
+        }
+        
+        desc.magic_flag = MAGIC_FLAG_DATA;
+        desc.block_size = physical;
+        desc.used_bytes = used;
+        writeDescriptor(position, &desc, sizeof(DATA_BLOCK_DESCRIPTOR));
+        
+        // The allocation is written out in full so the end of the store is claimed before anything else is allocated
+        Memory out(physical);
+        memcpy(out.operator char *(), payload, length);
+        memset(out.operator char *()+length, 0, physical-length);
+        writeRaw(position+sizeof(DATA_BLOCK_DESCRIPTOR), out.operator char *(), physical);
+        
+        if (!moved)
+            return position;
+        
+        if (!block_number)
+            fd->first_data_block = position;
+        else {
+            DATA_BLOCK_DESCRIPTOR previous;
+            unsigned long long previous_offset = getDataBlockOffset(file, block_number-1);
+            readDescriptor(previous_offset, &previous, sizeof(DATA_BLOCK_DESCRIPTOR));
+            previous.next_data_block = position;
+            writeDescriptor(previous_offset, &previous, sizeof(DATA_BLOCK_DESCRIPTOR));
+        }
+        
+        if (!desc.next_data_block)
+            fd->last_data_block = position;
+        
+        indexDataBlocks(file, block_number, &position, 1);
+        if (block_number == fd->block_count)
+            fd->block_count++;
+        updateFileDescriptor(file);
+        
+        return position;
+    }
+
+    void IndexedDataStore::readBlockData(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long position, const DATA_BLOCK_DESCRIPTOR *desc, char *buffer) {
+        // Reads used_bytes of logical data into buffer, decoding the block when it was stored compressed
+        unsigned long long data_offset = position+sizeof(DATA_BLOCK_DESCRIPTOR);
+        if (!isCompressedFile(file) || desc->block_size >= file.getPtr()->descriptor.block_size) {
+            readData(data_offset, buffer, desc->used_bytes);
+            return;
+        }
+        
+        const char *packed = batch_depth ? 0 : this->file.getMapping(data_offset, desc->block_size);
+        Memory mem;
+        if (!packed) {
+            mem = Memory(desc->block_size);
+            readData(data_offset, mem.operator char *(), desc->block_size);
+            packed = mem.operator char *();
+        }
+        
+        if (!BlockCodec::decompress(packed, desc->block_size, buffer, desc->used_bytes))
+            throw "Invalid compressed block";
+    }
+
+    Ref<IndexedDataStore::LOADED_BLOCK_INDEX> IndexedDataStore::loadBlockIndex(unsigned long long offset) {
+        LOADED_BLOCK_INDEX *index = new LOADED_BLOCK_INDEX;
+        readDescriptor(offset, &index->descriptor, sizeof(BLOCK_INDEX));
+        
+        if (index->descriptor.magic_flag != MAGIC_FLAG_BLOCK_INDEX) {
+            delete index;
+            throw "Invalid block index";
+        }
+        
+        index->offset = offset;
+        
+        return Ref<LOADED_BLOCK_INDEX>(index);
+    }
+
+    Ref<IndexedDataStore::LOADED_BLOCK_INDEX> IndexedDataStore::createBlockIndex(unsigned int depth) {
+        LOADED_BLOCK_INDEX *index = new LOADED_BLOCK_INDEX;
+        memset(&index->descriptor, 0, sizeof(BLOCK_INDEX));
+        index->descriptor.magic_flag = MAGIC_FLAG_BLOCK_INDEX;
+        index->descriptor.depth = depth;
+        index->offset = allocate(sizeof(BLOCK_INDEX));
+        
+        Ref<LOADED_BLOCK_INDEX> ret(index);
+        updateBlockIndex(ret);
+        return ret;
+    }
+
+    void IndexedDataStore::updateBlockIndex(Ref<LOADED_BLOCK_INDEX> index) {
+        writeDescriptor(index.getPtr()->offset, &index.getPtr()->descriptor, sizeof(BLOCK_INDEX));
+    }
+
+    Ref<IndexedDataStore::LOADED_BLOCK_INDEX> IndexedDataStore::getBlockIndexLeaf(Ref<LOADED_FILE_DESCRIPTOR> file_desc, unsigned int block_number, bool create) {
+        // The caller is responsible for writing the file descriptor when the root changes
+        FILE_DESCRIPTOR *fd = &file_desc.getPtr()->descriptor;
+        Ref<LOADED_BLOCK_INDEX> index;
+        
+        if (!fd->block_index) {
+            if (!create)
+                return index;
+            index = createBlockIndex(0);
+            fd->block_index = index.getPtr()->offset;
+        } else
+            index = loadBlockIndex(fd->block_index);
+        
+        // Grow the radix upwards until the root spans block_number
+        unsigned long long span = BLOCK_INDEX_SIZE;
+        for (unsigned int i=0; i<index.getPtr()->descriptor.depth; i++)
+            span *= BLOCK_INDEX_SIZE;
+        
+        while (block_number >= span) {
+            if (!create)
+                return Ref<LOADED_BLOCK_INDEX>();
+            
+            Ref<LOADED_BLOCK_INDEX> root = createBlockIndex(index.getPtr()->descriptor.depth+1);
+            root.getPtr()->descriptor.entry[0] = index.getPtr()->offset;
+            updateBlockIndex(root);
+            
+            fd->block_index = root.getPtr()->offset;
+            index = root;
+            span *= BLOCK_INDEX_SIZE;
+        }
+        
+        while (index.getPtr()->descriptor.depth) {
+            span /= BLOCK_INDEX_SIZE;
+            unsigned int slot = (unsigned int)((block_number/span)%BLOCK_INDEX_SIZE);
+            unsigned long long child = index.getPtr()->descriptor.entry[slot];
+            
+            if (!child) {
+                if (!create)
+                    return Ref<LOADED_BLOCK_INDEX>();
+                
+                Ref<LOADED_BLOCK_INDEX> node = createBlockIndex(index.getPtr()->descriptor.depth-1);
+                index.getPtr()->descriptor.entry[slot] = node.getPtr()->offset;
+                updateBlockIndex(index);
+                index = node;
+            } else
+                index = loadBlockIndex(child);
+        }
+        
+        return index;
+    }
+
+    unsigned long long IndexedDataStore::getDataBlockOffset(Ref<LOADED_FILE_DESCRIPTOR> file_desc, unsigned int block_number) {
+        Ref<LOADED_BLOCK_INDEX> leaf = getBlockIndexLeaf(file_desc, block_number, false);
+        if (!leaf.getPtr())
+            throw "Block index is missing a data block";
+        
+        return leaf.getPtr()->descriptor.entry[block_number%BLOCK_INDEX_SIZE];
+    }
+
+    void IndexedDataStore::indexDataBlocks(Ref<LOADED_FILE_DESCRIPTOR> file_desc, unsigned int first_block, const unsigned long long *blocks, unsigned int count) {
+        // Each leaf touched is written once, no matter how many entries land in it
+        Ref<LOADED_BLOCK_INDEX> leaf;
+        
+        for (unsigned int i=0; i<count; i++) {
+            unsigned int block_number = first_block+i;
+            
+            if (!leaf.getPtr() || block_number%BLOCK_INDEX_SIZE == 0) {
+                if (leaf.getPtr())
+                    updateBlockIndex(leaf);
+                leaf = getBlockIndexLeaf(file_desc, block_number, true);
+            }
+            
+            leaf.getPtr()->descriptor.entry[block_number%BLOCK_INDEX_SIZE] = blocks[i];
+        }
+        
+        if (leaf.getPtr())
+            updateBlockIndex(leaf);
+    }
+
+    void IndexedDataStore::updateDataBlockDescriptor(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor) {
+        writeDescriptor(descriptor.getPtr()->offset, &descriptor.getPtr()->descriptor, sizeof(DATA_BLOCK_DESCRIPTOR));
+    }
+
+    void IndexedDataStore::markDataBlockDirty(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor, unsigned int start, unsigned int end) {
+        // Overlapping and adjacent ranges are merged, so the list stays short for appends and rewrites
+        std::vector< std::pair<unsigned int, unsigned int> > &dirty = descriptor.getPtr()->dirty;
+        if (start >= end)
+            return;
+        
+        std::vector< std::pair<unsigned int, unsigned int> >::iterator it = dirty.begin();
+        while (it != dirty.end() && it->second < start)
+            it++;
+        
+        while (it != dirty.end() && it->first <= end) {
+            if (it->first < start)
+                start = it->first;
+            if (it->second > end)
+                end = it->second;
+            it = dirty.erase(it);
+        }
+        
+        dirty.insert(it, std::pair<unsigned int, unsigned int>(start, end));
+    }
+
+    void IndexedDataStore::updateDataBlockData(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor, bool update_descriptor) {
+        // Ranges less than DIRTY_MERGE_GAP apart are written together with the clean bytes between them, the descriptor
+        // sits right in front of the data and is joined to the first range in the same way
+        LOADED_DATA_BLOCK_DESCRIPTOR *block = descriptor.getPtr();
+        std::vector< std::pair<unsigned int, unsigned int> > &dirty = block->dirty;
+        const char *data = block->data.operator char *();
+        unsigned long long data_offset = block->offset+sizeof(DATA_BLOCK_DESCRIPTOR);
+        size_t i = 0;
+        
+        if (update_descriptor) {
+            unsigned int end = 0;
+            for (; i<dirty.size() && dirty[i].first <= end+DIRTY_MERGE_GAP; i++)
+                end = dirty[i].second;
+            
+            if (end) {
+                Memory run(sizeof(DATA_BLOCK_DESCRIPTOR)+end);
+                memcpy(run.operator char *(), &block->descriptor, sizeof(DATA_BLOCK_DESCRIPTOR));
+                memcpy(run.operator char *()+sizeof(DATA_BLOCK_DESCRIPTOR), data, end);
+                writeRaw(block->offset, run.operator char *(), run.length());
+                cache.put(block->offset, &block->descriptor, sizeof(DATA_BLOCK_DESCRIPTOR));
+            } else
+                updateDataBlockDescriptor(descriptor);
+        }
+        
+        while (i < dirty.size()) {
+            unsigned int start = dirty[i].first;
+            unsigned int end = dirty[i].second;
+            for (i++; i<dirty.size() && dirty[i].first <= end+DIRTY_MERGE_GAP; i++)
+                end = dirty[i].second;
+            
+            writeRaw(data_offset+start, data+start, end-start);
+        }
+        
+        dirty.clear();
+    }
+
+    bool IndexedDataStore::releaseBlockIndex(unsigned long long offset, unsigned long long first_block, unsigned long long span, unsigned long long keep) {
+        // Releases every data block numbered keep or above below this node, along with nodes left empty.
+        // span is the number of blocks covered by each entry, returns true when the node itself was released.
+        Ref<LOADED_BLOCK_INDEX> index = loadBlockIndex(offset);
+        BLOCK_INDEX *bi = &index.getPtr()->descriptor;
+        bool changed = false;
+        bool empty = true;
+        
+        if (!keep) {
+            span = 1;
+            for (unsigned int i=0; i<bi->depth; i++)
+                span *= BLOCK_INDEX_SIZE;
+        }
+        
+        for (int i=0; i<BLOCK_INDEX_SIZE; i++) {
+            if (!bi->entry[i])
+                continue;
+            
+            unsigned long long block = first_block+i*span;
+            if (block+span <= keep) {
+                empty = false;
+                continue;
+            }
+            
+            bool released = true;
+            if (!bi->depth)
+                release(bi->entry[i], sizeof(DATA_BLOCK_DESCRIPTOR)+loadDataDescriptor(bi->entry[i]).getPtr()->descriptor.block_size);
+            else
+                released = releaseBlockIndex(bi->entry[i], block, span/BLOCK_INDEX_SIZE, keep > block ? keep : 0);
+            
+            if (released) {
+                bi->entry[i] = 0;
+                changed = true;
+            } else
+                empty = false;
+        }
+        
+        if (empty) {
+            release(offset, sizeof(BLOCK_INDEX));
+            return true;
+        }
+        
+        if (changed)
+            updateBlockIndex(index);
+        
+        return false;
+    }
+
+    void IndexedDataStore::openSuperblock() {
+        // Version 1 stores start with the root index descriptor itself
+        SUPERBLOCK superblock;
+        readDescriptor(0, &superblock, sizeof(SUPERBLOCK));
+        node_extent = 0;
+        node_next = 0;
+        superblock_next = 0;
+        
+        if (superblock.magic_flag != MAGIC_FLAG_SUPERBLOCK) {
+            format_version = 1;
+            root_offset = 0;
+            return;
+        }
+        
+        if (superblock.version > STORE_FORMAT_VERSION || superblock.node_align != NODE_ALIGN)
+            throw "Unsupported store format";
+        
+        format_version = superblock.version;
+        root_offset = superblock.root;
+        
+        // Superblocks without node_next have the rest of their extent left unused, a new one is reserved for the next node
+        if (superblock.node_extent) {
+            node_extent = superblock.node_extent;
+            node_next = superblock.node_next ? superblock.node_next : node_extent+NODE_EXTENT_SIZE;
+            superblock_next = superblock.node_next;
+        }
+    }
+
+    void IndexedDataStore::writeSuperblock(unsigned long long next) {
+        SUPERBLOCK superblock;
+        memset(&superblock, 0, sizeof(SUPERBLOCK));
+        superblock.magic_flag = MAGIC_FLAG_SUPERBLOCK;
+        superblock.version = STORE_FORMAT_VERSION;
+        superblock.node_align = NODE_ALIGN;
+        superblock.root = root_offset;
+        superblock.node_extent = node_extent;
+        superblock.node_next = next;
+        writeDescriptor(0, &superblock, sizeof(SUPERBLOCK));
+        superblock_next = next;
+    }
+
+    void IndexedDataStore::openRecycledBlocks() {
+        unsigned long long offset = getRootDecriptor().getPtr()->descriptor.file;
+        
+        // Stores created before recycling existed only reserved the descriptor
+        FILE_DESCRIPTOR fd;
+        readDescriptor(offset, &fd, sizeof(FILE_DESCRIPTOR));
+        if (!fd.magic_flag) {
+            memset(&fd, 0, sizeof(FILE_DESCRIPTOR));
+            fd.magic_flag = MAGIC_FLAG_FILE;
+            fd.block_size = sizeof(FREE_LIST)*BANK_SIZE;
+            writeRaw(offset, (const char*)&fd, LEGACY_FILE_DESCRIPTOR_SIZE);
+            cache.invalidate(offset);
+        }
+        
+        recycled_blocks = loadFileDescriptor(offset);
+        free_lists.clear();
+        free_list_index.clear();
+        
+        unsigned long long size = getFileSize(recycled_blocks);
+        if (size) {
+            Memory lists = readFromFile(recycled_blocks, 0, size);
+            for (size_t i=0; i+sizeof(FREE_LIST) <= lists.length(); i+=sizeof(FREE_LIST)) {
+                FREE_LIST list;
+                memcpy(&list, lists.operator char *()+i, sizeof(FREE_LIST));
+                free_list_index[list.size] = (unsigned int)free_lists.size();
+                free_lists.push_back(list);
+            }
+        }
+    }
+
+    unsigned long long IndexedDataStore::allocate(size_t size, bool recycle) {
+        // Callers must write to the returned offset before allocating again, the end of the store is only claimed by writing to it
+        if (recycle) {
+            unsigned long long offset = popFreeList(size);
+            if (offset)
+                return offset;
+        }
+        
+        return storeLength();
+    }
+
+    unsigned long long IndexedDataStore::popFreeList(unsigned long long size) {
+        // Offset 0 is the root or the superblock, never a free block, so it stands for an empty list
+            std::unordered_map<unsigned long long, unsigned int>::iterator it = free_list_index.find(size);
+        if (it == free_list_index.end() || !free_lists[it->second].head)
+            return 0;
+        
+                FREE_LIST *list = &free_lists[it->second];
+                unsigned long long offset = list->head;
+                
+                FREE_BLOCK block;
+                readDescriptor(offset, &block, sizeof(FREE_BLOCK));
+                if (block.magic_flag != MAGIC_FLAG_FREE)
+                    throw "Invalid free block";
+                
+                list->head = block.next;
+                list->count--;
+                updateFreeList(it->second);
+                
+                return offset;
+            }
+
+    unsigned long long IndexedDataStore::allocateNode(size_t size) {
+        // Version 2 nodes are addressed by node number and kept together in extents, which keeps the index dense
+        if (format_version < 2)
+            return allocate(size);
+        
+        unsigned long long offset = popFreeList(size | FREE_LIST_NODE);
+        if (offset)
+            return offset;
+        
+        if (!node_extent || node_next+size > node_extent+NODE_EXTENT_SIZE)
+            reserveNodeExtent();
+        
+        // The superblock is only brought up to date at commit and on close. Writes outside a batch are not undone by a crash,
+        // so before the first node past what it records, it is marked to leave the rest of the extent unused instead.
+        if (root_offset && superblock_next && !batch_depth)
+            writeSuperblock(0);
+        
+        offset = node_next;
+        node_next += size;
+        return offset;
+    }
+
+    void IndexedDataStore::reserveNodeExtent() {
+        unsigned long long offset = storeLength();
+        offset += (NODE_ALIGN-offset%NODE_ALIGN)%NODE_ALIGN;
+        toNodeNumber(offset+NODE_EXTENT_SIZE-NODE_ALIGN);
+        
+        // Writing the last unit claims the whole extent, the rest reads as zeros until nodes are written to it
+        char zero[NODE_ALIGN];
+        memset(zero, 0, NODE_ALIGN);
+        writeRaw(offset+NODE_EXTENT_SIZE-NODE_ALIGN, zero, NODE_ALIGN);
+        
+        node_extent = offset;
+        node_next = offset;
+        
+        // A store being created or upgraded has no superblock yet, it is written once the root is in place
+        if (root_offset)
+            writeSuperblock(0);
+    }
+
+    void IndexedDataStore::release(unsigned long long offset, unsigned long long size) {
+        std::unordered_map<unsigned long long, unsigned int>::iterator it = free_list_index.find(size);
+        unsigned int index;
+        
+        if (it == free_list_index.end()) {
+            FREE_LIST list;
+            memset(&list, 0, sizeof(FREE_LIST));
+            list.size = size;
+            
+            index = (unsigned int)free_lists.size();
+            free_list_index[size] = index;
+            free_lists.push_back(list);
+        } else
+            index = it->second;
+        
+        FREE_BLOCK block;
+        block.magic_flag = MAGIC_FLAG_FREE;
+        block.next = free_lists[index].head;
+        writeDescriptor(offset, &block, sizeof(FREE_BLOCK));
+        
+        free_lists[index].head = offset;
+        free_lists[index].count++;
+        updateFreeList(index);
+    }
+
+    void IndexedDataStore::releaseNode(unsigned long long offset, size_t size) {
+        // Other records of the same size can start anywhere, version 2 nodes get lists of their own so they stay aligned
+        if (format_version < 2)
+            release(offset, size);
+        else
+            release(offset, size | FREE_LIST_NODE);
+    }
+
+    void IndexedDataStore::updateFreeList(unsigned int index) {
+        writeToFile(recycled_blocks, Memory(&free_lists[index], sizeof(FREE_LIST)), index*sizeof(FREE_LIST), sizeof(FREE_LIST));
+    }
+
+    void IndexedDataStore::readIndexNode(unsigned long long offset, INDEX_DESCRIPTOR *descriptor) {
+        if (format_version < 2) {
+            readDescriptor(offset, descriptor, sizeof(INDEX_DESCRIPTOR));
+            return;
+        }
+        
+        COMPACT_INDEX_DESCRIPTOR node;
+        readDescriptor(offset, &node, sizeof(COMPACT_INDEX_DESCRIPTOR));
+        decodeIndexNode(&node, descriptor);
+    }
+
+    void IndexedDataStore::writeIndexNode(unsigned long long offset, const INDEX_DESCRIPTOR *descriptor) {
+        if (format_version < 2) {
+            writeDescriptor(offset, descriptor, sizeof(INDEX_DESCRIPTOR));
+            return;
+        }
+        
+        COMPACT_INDEX_DESCRIPTOR node;
+        encodeIndexNode(descriptor, &node);
+        writeDescriptor(offset, &node, sizeof(COMPACT_INDEX_DESCRIPTOR));
+    }
+
+    void IndexedDataStore::readBankNode(unsigned long long offset, BANK_MAP *bmap) {
+        if (format_version < 2) {
+            readDescriptor(offset, bmap, sizeof(BANK_MAP));
+            return;
+        }
+        
+        COMPACT_BANK_MAP node;
+        readDescriptor(offset, &node, sizeof(COMPACT_BANK_MAP));
+        memset(bmap, 0, sizeof(BANK_MAP));
+        bmap->magic_flag = node.magic_flag;
+        for (int i=0; i<256/BANK_SIZE; i++)
+            bmap->banks[i] = node.banks[i] || node.banks_high[i] ? decodeNodeLink(node.banks[i], node.banks_high[i]) : 0;
+    }
+
+    void IndexedDataStore::writeBankNode(unsigned long long offset, const BANK_MAP *bmap) {
+        if (format_version < 2) {
+            writeDescriptor(offset, bmap, sizeof(BANK_MAP));
+            return;
+        }
+        
+        COMPACT_BANK_MAP node;
+        memset(&node, 0, sizeof(COMPACT_BANK_MAP));
+        node.magic_flag = bmap->magic_flag;
+        for (int i=0; i<256/BANK_SIZE; i++) {
+            if (bmap->banks[i])
+                encodeNodeLink(bmap->banks[i], false, &node.banks[i], &node.banks_high[i]);
+        }
+        writeDescriptor(offset, &node, sizeof(COMPACT_BANK_MAP));
+    }
+
+    size_t IndexedDataStore::indexNodeSize() {
+        return format_version < 2 ? sizeof(INDEX_DESCRIPTOR) : sizeof(COMPACT_INDEX_DESCRIPTOR);
+    }
+
+    size_t IndexedDataStore::bankNodeSize() {
+        return format_version < 2 ? sizeof(BANK_MAP) : sizeof(COMPACT_BANK_MAP);
+    }
+
+    void IndexedDataStore::readDescriptor(unsigned long long offset, void *descriptor, size_t length) {
+        // Mapped stores copy straight out of the mapping, pending batch writes have to go through readRaw
+        STATS_COUNT(stats.descriptor_reads, 1);
+        if (!batch_depth) {
+            const char *mapping = file.getMapping(offset, length);
+            if (mapping) {
+                memcpy(descriptor, mapping, length);
+                return;
+            }
+        }
+        
+        if (cache.get(offset, descriptor, length))
+            return;
+        
+        readData(offset, (char*)descriptor, length);
+        cache.put(offset, descriptor, length);
+    }
+
+    void IndexedDataStore::writeDescriptor(unsigned long long offset, const void *descriptor, size_t length) {
+        writeRaw(offset, (const char*)descriptor, length);
+        cache.put(offset, descriptor, length);
+    }
+
+    Memory IndexedDataStore::readRaw(unsigned long long offset, size_t length) {
+        if (!batch_depth)
+            return file.read(offset, length);
+        
+        // Reads within a batch see its pending writes, including space appended by the batch
+        unsigned long long end = storeLength();
+        if (offset >= end)
+            return Memory();
+        if (offset+length > end)
+            length = (size_t)(end-offset);
+        
+        Memory mem(length);
+        Memory stored = file.read(offset, length);
+        memcpy(mem.operator char *(), stored.operator char *(), stored.length());
+        memset(mem.operator char *()+stored.length(), 0, length-stored.length());
+        wal.overlay(offset, mem.operator char *(), length);
+        
+        return mem;
+    }
+
+    void IndexedDataStore::writeRaw(unsigned long long offset, const char *data, size_t length) {
+        modifications++;
+        if (batch_depth) {
+            wal.write(offset, data, length);
+            return;
+        }
+        
+        // Direct writes must not be overtaken by log records replayed after a crash
+        if (!wal.isClean())
+            wal.checkpoint(file);
+        
+        file.write(offset, data, length);
+    }
+
+    void IndexedDataStore::reserveRaw(unsigned long long end) {
+        // Extends the store without writing to it, the new space reads back as zeros
+        if (batch_depth) {
+            wal.reserve(end);
+            return;
+        }
+        
+        file.reserve(end);
+    }
+
+    unsigned long long IndexedDataStore::storeLength() {
+        unsigned long long length = file.length();
+        if (batch_depth && wal.getEnd() > length)
+            length = wal.getEnd();
+        return length;
+    }
+
+    void IndexedDataStore::beginBatch() {
+        // The write lock is held until the batch is committed or rolled back
+        lock.writeLock();
+        if (batch_depth) {
+            // Rolling back to the mark reloads the superblock, it has to cover the nodes the outer batch allocated
+            if (root_offset && node_next != superblock_next)
+                writeSuperblock(node_next);
+            wal.mark();
+        } else {
+            batch_node_extent = node_extent;
+            batch_node_next = node_next;
+        }
+        batch_depth++;
+    }
+
+    void IndexedDataStore::commit() {
+        ReadWriteLock::Writer writer(lock);
+        if (!batch_depth)
+            return;
+        
+        // Logged with the nodes it covers, so the superblock and the nodes reach the store together
+        if (batch_depth == 1 && root_offset && node_next != superblock_next)
+            writeSuperblock(node_next);
+        
+        lock.writeUnlock();
+        if (--batch_depth) {
+            wal.releaseMark();
+            return;
+        }
+        
+        STATS_TIME(stats.commit_latency);
+        STATS_COUNT(stats.commits, 1);
+        wal.commit(file);
+    }
+
+    void IndexedDataStore::rollback() {
+        ReadWriteLock::Writer writer(lock);
+        if (!batch_depth)
+            return;
+        
+        // Only the innermost batch is undone, the enclosing batches keep their writes and their lock
+        lock.writeUnlock();
+        if (--batch_depth)
+            wal.rollbackToMark();
+        else
+            wal.discard();
+        
+        // Cached descriptors, free lists and the node extent may hold state from the discarded writes
+        modifications++;
+        cache.clear();
+        openSuperblock();
+        openRecycledBlocks();
+        
+        // The superblock on disk may leave out nodes allocated before the batch, outside of it
+        if (!batch_depth && root_offset) {
+            node_extent = batch_node_extent;
+            node_next = batch_node_next;
+        }
+    }
+
+    void IndexedDataStore::setCacheSize(size_t entries) {
+        cache.setCapacity(entries);
+    }
+
+    unsigned long long IndexedDataStore::getCacheHits() {
+        return cache.getHits();
+    }
+
+    unsigned long long IndexedDataStore::getCacheMisses() {
+        return cache.getMisses();
+    }
+
+    IndexedDataStore::STORE_STATS IndexedDataStore::getStats() {
+        STORE_STATS ret;
+        memset(&ret, 0, sizeof(STORE_STATS));
+        
+#if !STATS_DISABLED
+        ret.lookups = stats.lookups.get();
+        ret.filter_rejects = stats.filter_rejects.get();
+        ret.descriptor_reads = stats.descriptor_reads.get();
+        ret.chain_hops = stats.chain_hops.get();
+        ret.reads = stats.reads.get();
+        ret.bytes_requested = stats.bytes_requested.get();
+        ret.bytes_read = stats.bytes_read.get();
+        ret.writes = stats.writes.get();
+        ret.bytes_written = stats.bytes_written.get();
+        ret.commits = stats.commits.get();
+        stats.lookup_latency.snapshot(&ret.lookup_latency);
+        stats.read_latency.snapshot(&ret.read_latency);
+        stats.write_latency.snapshot(&ret.write_latency);
+        stats.commit_latency.snapshot(&ret.commit_latency);
+#endif
+        
+        ret.cache_hits = cache.getHits();
+        ret.cache_misses = cache.getMisses();
+        ret.file = file.getStats();
+        
+        return ret;
+    }
+
+    void IndexedDataStore::resetStats() {
+#if !STATS_DISABLED
+        stats.lookups.reset();
+        stats.filter_rejects.reset();
+        stats.descriptor_reads.reset();
+        stats.chain_hops.reset();
+        stats.reads.reset();
+        stats.bytes_requested.reset();
+        stats.bytes_read.reset();
+        stats.writes.reset();
+        stats.bytes_written.reset();
+        stats.commits.reset();
+        stats.lookup_latency.reset();
+        stats.read_latency.reset();
+        stats.write_latency.reset();
+        stats.commit_latency.reset();
+#endif
+        
+        cache.resetCounters();
+        file.resetStats();
+    }
+
+    IndexedDataStore::POOL_USAGE IndexedDataStore::getPoolUsage() {
+        POOL_USAGE usage;
+        usage.index_descriptors = LOADED_INDEX_DESCRIPTOR::getPool().getUsage();
+        usage.prefix_descriptors = LOADED_PREFIX_DESCRIPTOR::getPool().getUsage();
+        usage.bank_maps = LOADED_BANK_MAP::getPool().getUsage();
+        usage.file_descriptors = LOADED_FILE_DESCRIPTOR::getPool().getUsage();
+        usage.data_blocks = LOADED_DATA_BLOCK_DESCRIPTOR::getPool().getUsage();
+        usage.block_indexes = LOADED_BLOCK_INDEX::getPool().getUsage();
+        
+        ObjectPool::USAGE *pools[] = {&usage.index_descriptors, &usage.prefix_descriptors, &usage.bank_maps, &usage.file_descriptors, &usage.data_blocks, &usage.block_indexes};
+        usage.bytes = 0;
+        for (size_t i=0; i<sizeof(pools)/sizeof(pools[0]); i++)
+            usage.bytes += (pools[i]->in_use+pools[i]->pooled)*pools[i]->object_size;
+        
+        return usage;
+    }
+
+    void IndexedDataStore::trimPools() {
+        LOADED_INDEX_DESCRIPTOR::getPool().trim();
+        LOADED_PREFIX_DESCRIPTOR::getPool().trim();
+        LOADED_BANK_MAP::getPool().trim();
+        LOADED_FILE_DESCRIPTOR::getPool().trim();
+        LOADED_DATA_BLOCK_DESCRIPTOR::getPool().trim();
+        LOADED_BLOCK_INDEX::getPool().trim();
+    }
+
+    IndexedDataStore::COMPACT_STATS IndexedDataStore::compact(CompactProgress progress, void *context) {
+        ReadWriteLock::Writer writer(lock);
+        if (batch_depth)
+            throw "Cannot compact during a batch";
+        
+        COMPACT_STATS stats;
+        memset(&stats, 0, sizeof(COMPACT_STATS));
+        stats.original_size = file.length();
+        
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        
+        // Every key with a file, in key order
+        std::vector<Memory> keys;
+        std::vector<unsigned long long> files;
+        Cursor cursor(this, Memory());
+        while (cursor.next()) {
+            keys.push_back(Memory(cursor.getKey(), cursor.getKeyLength()));
+            files.push_back(cursor.getFile().getPtr()->offset);
+        }
+        stats.total_files = keys.size();
+        
+        String compact_path = path + ".compact";
+        unlink(compact_path.operator char *());
+        unlink((compact_path + ".wal").operator char *());
+        
+        {
+            IndexedDataStore dest(compact_path);
+            std::vector<unsigned long long> dest_files(keys.size());
+            
+            // Trie nodes and file descriptors are created shortest key first, which lays the trie out roughly breadth first
+            std::vector<size_t> order(keys.size());
+            for (size_t i=0; i<order.size(); i++)
+                order[i] = i;
+            
+            LengthOrder length_order = {&keys};
+            std::sort(order.begin(), order.end(), length_order);
+            
+            for (size_t i=0; i<order.size(); i++) {
+                VALUE_RECORD record;
+                readFileDescriptor(files[order[i]], &record.descriptor);
+                
+                Ref<LOADED_INDEX_DESCRIPTOR> desc = dest.findDescriptor(keys[order[i]], true);
+                if (record.descriptor.magic_flag == MAGIC_FLAG_VALUE_FILE) {
+                    // Values are small enough to be copied with their record
+                    readDescriptor(files[order[i]], &record, sizeof(VALUE_RECORD));
+                    dest_files[order[i]] = dest.createValueFile(desc, Memory(record.data, (size_t)record.descriptor.file_size));
+                } else
+                    dest_files[order[i]] = dest.createKeyFile(desc, record.descriptor.block_size, record.descriptor.flags & FILE_FLAG_COMPRESSED).getPtr()->offset;
+            }
+            
+            // File data follows in key order, each file written out in one sequential run of blocks
+            for (size_t i=0; i<keys.size(); i++) {
+                Ref<LOADED_FILE_DESCRIPTOR> src = loadFileDescriptor(files[i]);
+                Ref<LOADED_FILE_DESCRIPTOR> dst = dest.loadFileDescriptor(dest_files[i]);
+                
+                unsigned long long size = dest.isValueFile(dst) ? 0 : getFileSize(src);
+                unsigned long long chunk = (unsigned long long)src.getPtr()->descriptor.block_size*COMPACT_CHUNK_BLOCKS;
+                for (unsigned long long offset=0; offset<size; offset+=chunk) {
+                    Memory data = readFileData(src, offset, chunk);
+                    dest.writeToFile(dst, data, offset, data.length());
+                    stats.bytes += data.length();
+                }
+                
+                stats.files++;
+                if (progress && stats.files%COMPACT_PROGRESS_INTERVAL == 0) {
+                    stats.elapsed = elapsedSince(start);
+                    stats.bytes_per_second = stats.elapsed > 0 ? stats.bytes/stats.elapsed : 0;
+                    progress(&stats, context);
+                }
+            }
+            
+            dest.file.sync();
+            stats.compacted_size = dest.file.length();
+        }
+        
+        // Nothing of the old store may be left in its log once the new store is in place
+        wal.checkpoint(file);
+        if (rename(compact_path.operator char *(), path.operator char *()) != 0)
+            throw "Failed to replace store";
+        
+        file.reopen();
+        modifications++;
+        cache.clear();
+        upgraded_files.clear();
+        openSuperblock(); // Compaction also brings older stores up to the current format
+        openRecycledBlocks();
+        rebuildFilter(); // Drops deleted keys
+        
+        stats.elapsed = elapsedSince(start);
+        stats.bytes_per_second = stats.elapsed > 0 ? stats.bytes/stats.elapsed : 0;
+        if (progress)
+            progress(&stats, context);
+        
+        return stats;
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getRootDecriptor() {
+        return loadIndexDescriptor(root_offset);
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getSystemDecriptor() {
+        Ref<LOADED_INDEX_DESCRIPTOR> root = getRootDecriptor();
+        return loadIndexDescriptor(root.getPtr()->descriptor.slot[0] & SLOT_OFFSET_MASK);
+    }
+
+    Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> IndexedDataStore::getUserDecriptor() {
+        Ref<LOADED_INDEX_DESCRIPTOR> root = getRootDecriptor();
+        return loadIndexDescriptor(root.getPtr()->descriptor.slot[1] & SLOT_OFFSET_MASK);
+    }
+
+    RefArray<int> IndexedDataStore::getChildIndexes(Memory key) {
+        ReadWriteLock::Reader reader(lock);
+        int pending;
+        Ref<IndexedDataStore::LOADED_INDEX_DESCRIPTOR> desc = findDescriptor(key, false, &pending);
+
+        Array<int> list;
+
+        if (!desc.getPtr()) {
+            // The key ends part way through a prefix segment, its only child is the next byte of the segment
+            if (pending < 0)
+                throw "Failed to get file key";
+            list.push(pending);
+        } else if (desc.getPtr()->descriptor.next_index_descriptor & NEXT_BANK_MAP) {
+            Ref<LOADED_BANK_MAP> bmap = loadBankMap(desc.getPtr()->descriptor.next_index_descriptor & ~NEXT_BANK_MAP);
+            for (int b=0; b<256/BANK_SIZE; b++) {
+                if (!bmap.getPtr()->descriptor.banks[b])
+                    continue;
+                
+                Ref<LOADED_INDEX_DESCRIPTOR> bank = loadIndexDescriptor(bmap.getPtr()->descriptor.banks[b]);
+                for (int i=0; i<BANK_SIZE; i++) {
+                    if (bank.getPtr()->descriptor.slot[i] & SLOT_IN_USE)
+                        list.push(bank.getPtr()->descriptor.range_start+i);
+                }
+            }
+        } else {
+            while (true) {
+                for (int i=0; i<BANK_SIZE; i++) {
+                    if (desc.getPtr()->descriptor.slot[i] & SLOT_IN_USE)
+                        list.push(desc.getPtr()->descriptor.range_start+i);
+                }
+
+                if (!desc.getPtr()->descriptor.next_index_descriptor)
+                    break;
+                
+                desc = loadIndexDescriptor(desc.getPtr()->descriptor.next_index_descriptor);
+            }
+        }
+
+        // Siblings are chained in creation order, return the indexes in key order
+        int len = list.length();
+        int *ret = new int[len+1];
+        for (int i=0; i<len; i++) {
+            int j = i;
+            int value = list.get(i);
+            while (j > 0 && ret[j-1] > value) {
+                ret[j] = ret[j-1];
+                j--;
+            }
+            ret[j] = value;
+        }
+        ret[len] = -1;
+
         return RefArray(ret);
     }
 
+    IndexedDataStore::Cursor IndexedDataStore::scan(Memory prefix) {
+        return Cursor(this, prefix);
+    }
+
+    IndexedDataStore::Cursor::Cursor(IndexedDataStore *store, Memory prefix) : store(store), depth(0), emit_start(false) {
+        ReadWriteLock::Reader reader(store->lock);
+        modifications = store->modifications;
+        frames.resize(CURSOR_INITIAL_DEPTH);
+        key.reserve(256);
+        
+        LOADED_FILE_DESCRIPTOR *desc = new LOADED_FILE_DESCRIPTOR;
+        memset(desc, 0, sizeof(LOADED_FILE_DESCRIPTOR));
+        file = Ref<LOADED_FILE_DESCRIPTOR>(desc);
+        
+        key.insert(key.end(), (unsigned char*)prefix.operator char *(), (unsigned char*)prefix.operator char *()+prefix.length());
+        
+        // A prefix ending part way through a segment is completed one byte at a time up to the next descriptor
+        Ref<LOADED_INDEX_DESCRIPTOR> start;
+        while (true) {
+            int pending;
+            start = store->findDescriptor(Memory(getKey(), key.size()), false, &pending);
+            if (start.getPtr() || pending < 0)
+                break;
+            key.push_back((unsigned char)pending);
+        }
+        
+        if (!start.getPtr())
+            return;
+        
+        unsigned long long file_offset = push(start.getPtr()->offset);
+        if (file_offset)
+            emit_start = loadFile(file_offset);
+    }
+
+    bool IndexedDataStore::Cursor::next() {
+        ReadWriteLock::Reader reader(store->lock);
+        if (modifications != store->modifications)
+            throw "Store modified";
+        
+        if (emit_start) {
+            emit_start = false;
+            return true;
+        }
+        
+        while (depth) {
+            FRAME *frame = &frames[depth-1];
+            
+            int index = frame->next_index;
+            while (index < 256 && !(frame->slots[index] & SLOT_IN_USE))
+                index++;
+            
+            if (index == 256) {
+                depth--;
+                continue;
+            }
+            
+            frame->next_index = index+1;
+            key.resize(frame->key_length);
+            key.push_back((unsigned char)index);
+            
+            unsigned long long offset = frame->slots[index] & SLOT_OFFSET_MASK;
+            if (frame->slots[index] & SLOT_PREFIX) {
+                store->readDescriptor(offset, &prefix, sizeof(PREFIX_DESCRIPTOR));
+                if (prefix.magic_flag != MAGIC_FLAG_PREFIX || prefix.length > PREFIX_SEGMENT_SIZE)
+                    throw "Invalid prefix descriptor";
+                
+                key.insert(key.end(), prefix.segment, prefix.segment+prefix.length);
+                offset = prefix.next_index_descriptor;
+            }
+            
+            unsigned long long file_offset = push(offset);
+            if (file_offset && loadFile(file_offset))
+                return true;
+        }
+        
+        return false;
+    }
+
+    const char* IndexedDataStore::Cursor::getKey() {
+        return key.empty() ? "" : (const char*)&key[0];
+    }
+
+    size_t IndexedDataStore::Cursor::getKeyLength() {
+        return key.size();
+    }
+
+    Ref<IndexedDataStore::LOADED_FILE_DESCRIPTOR> IndexedDataStore::Cursor::getFile() {
+        return file;
+    }
+
+    unsigned long long IndexedDataStore::Cursor::push(unsigned long long offset) {
+        // All siblings of the descriptor are read up front into one table of 256 slots, which also puts them in key order
+        if (depth == frames.size())
+            frames.resize(frames.size()*2);
+        
+        FRAME *frame = &frames[depth++];
+        memset(frame->slots, 0, sizeof(frame->slots));
+        frame->next_index = 0;
+        frame->key_length = key.size();
+        
+        store->readIndexNode(offset, &node);
+        if (node.magic_flag != MAGIC_FLAG_INDEX)
+            throw "Invalid index descriptor";
+        
+        unsigned long long file_offset = node.file;
+        
+        if (node.next_index_descriptor & NEXT_BANK_MAP) {
+            BANK_MAP bmap;
+            store->readBankNode(node.next_index_descriptor & ~NEXT_BANK_MAP, &bmap);
+            if (bmap.magic_flag != MAGIC_FLAG_BANK_MAP)
+                throw "Invalid bank map";
+            
+            for (int b=0; b<256/BANK_SIZE; b++) {
+                if (!bmap.banks[b])
+                    continue;
+                store->readIndexNode(bmap.banks[b], &node);
+                memcpy(&frame->slots[node.range_start], node.slot, sizeof(node.slot));
+            }
+        } else {
+            while (true) {
+                memcpy(&frame->slots[node.range_start], node.slot, sizeof(node.slot));
+                if (!node.next_index_descriptor)
+                    break;
+                
+                store->readIndexNode(node.next_index_descriptor, &node);
+                if (node.magic_flag != MAGIC_FLAG_INDEX)
+                    throw "Invalid index descriptor";
+            }
+        }
+        
+        return file_offset;
+    }
+
+    bool IndexedDataStore::Cursor::loadFile(unsigned long long offset) {
+        store->readFileDescriptor(offset, &file.getPtr()->descriptor);
+        file.getPtr()->offset = offset;
+        return true;
+    }
+
 }
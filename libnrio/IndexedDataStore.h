@@ -10,127 +10,569 @@
 #define IndexDataStore_hpp
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
+
 #include <libnrcore/memory/Ref.h>
 #include <libnrcore/memory/Memory.h>
 #include <libnrcore/memory/String.h>
+#include <libnrcore/memory/Array.h>
 #include "File.h"
+#include "DescriptorCache.h"
+#include "WriteAheadLog.h"
+#include "ReadWriteLock.h"
+#include "BlockCodec.h"
+#include "BloomFilter.h"
+#include "AsyncIO.h"
+#include "ObjectPool.h"
 
 #define MAGIC_FLAG_INDEX    0xAAAAAAAA
 #define MAGIC_FLAG_FILE     0xBBBBBBBB
 #define MAGIC_FLAG_DATA     0xCCCCCCCC
 #define MAGIC_FLAG_BANK_MAP 0xDDDDDDDD
+#define MAGIC_FLAG_BLOCK_INDEX  0xEEEEEEEE
+#define MAGIC_FLAG_INDEXED_FILE 0xB1B1B1B1
+#define MAGIC_FLAG_VALUE_FILE   0xB2B2B2B2
+#define MAGIC_FLAG_PREFIX       0x99999999
+#define MAGIC_FLAG_FREE         0xFFFFFFFF
+#define MAGIC_FLAG_SUPERBLOCK   0x4F49524E // "NRIO"
+
+#define STORE_FORMAT_VERSION    2       // Version 1 stores have no superblock and start with the root INDEX_DESCRIPTOR
+#define NODE_ALIGN              64      // Version 2 index, bank map and prefix nodes start on a multiple of this
+#define NODE_EXTENT_SIZE        4096    // Version 2 nodes are packed into extents of this size, apart from other records
+#define NODE_NUMBER_MASK        0x7FFFFFFF
+#define NODE_NUMBER_FLAG        0x80000000 // SLOT_PREFIX in compact slots, NEXT_BANK_MAP in compact next links
+#define NODE_NUMBER_HIGH_SHIFT  31      // Node number bits above NODE_NUMBER_MASK are kept in the high word of a link
+#define NODE_NUMBER_MAX         0x7FFFFFFFFFFFULL
+#define FREE_LIST_NODE          0x8000000000000000ULL // Set in the size of free lists holding version 2 nodes, which are all NODE_ALIGN aligned
 
 #define BANK_SIZE 16
+#define BANK_MAP_THRESHOLD 4            // Descriptors a node chains before it is given a bank map
+#define BLOCK_INDEX_SIZE 64
+#define PREFIX_SEGMENT_SIZE 47
+#define CURSOR_INITIAL_DEPTH 16
+#define INLINE_VALUE_SIZE 32            // Values up to this size are stored in a VALUE_RECORD instead of data blocks
+#define EXTENT_WRITE_SIZE (1024*1024)   // Largest single write when appending a run of data blocks
+#define DIRTY_MERGE_GAP 256             // Dirty ranges of a data block closer than this are written as one
+#define PARALLEL_READ_SIZE (256*1024)   // Reads of at least this many bytes into a buffer keep all their block reads in flight
+#define PARALLEL_READ_WINDOW 256        // Blocks located and read together by a parallel read of an indexed file
+#define COMPACT_PROGRESS_INTERVAL 1024  // Files copied between progress reports
+#define COMPACT_CHUNK_BLOCKS 64         // Data blocks copied per read
+#define COMPRESSED_BLOCK_ALIGN 64       // Compressed blocks are allocated in multiples of this so rewrites can stay in place
+
+// Index descriptor slots
+#define SLOT_IN_USE         0x8000000000000000
+#define SLOT_PREFIX         0x4000000000000000 // Slot points to a PREFIX_DESCRIPTOR rather than an INDEX_DESCRIPTOR
+#define SLOT_OFFSET_MASK    0x3FFFFFFFFFFFFFFF
+
+// Index descriptor next_index_descriptor
+#define NEXT_BANK_MAP       0x8000000000000000 // Points to the node's BANK_MAP rather than the next sibling
+
+// File descriptor flags
+#define FILE_FLAG_VALUE_RECORD  0x00000001 // Descriptor started out as a VALUE_RECORD and occupies its allocation
+#define FILE_FLAG_COMPRESSED    0x00000002 // Data blocks are stored with BlockCodec
+
+// Files written before the block index existed only store the fields up to block_count
+#define LEGACY_FILE_DESCRIPTOR_SIZE offsetof(FILE_DESCRIPTOR, block_index)
 
 namespace nrcore {
 
     class IndexedDataStore {
     public:
+        // All on disk structures are fixed width with their padding spelled out, so a store has the same layout on
+        // every platform. Version 1 stores use these layouts for every node.
         typedef struct {
-            unsigned long magic_flag;
-            unsigned char range_start;      // Start of first 16 entries
-            unsigned long long next_index_descriptor; // if the most significant bit is a 1, this is a bank map, not a chained list
-            unsigned long long file;        // File which holds data block for recycling
-            unsigned long long slot[BANK_SIZE];    // Most significant bit indicates if in use or not
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint8_t range_start;            // Start of first 16 entries
+            uint8_t padding[7];
+            uint64_t next_index_descriptor; // if the most significant bit is a 1, this is a bank map, not a chained list
+            uint64_t file;                  // File which holds data block for recycling
+            uint64_t slot[BANK_SIZE];       // Most significant bit indicates if in use or not
         } INDEX_DESCRIPTOR;
 
         typedef struct {
-            unsigned long magic_flag;
-            unsigned long long banks[256/BANK_SIZE];
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint64_t banks[256/BANK_SIZE];
         } BANK_MAP;
+
+        // Path compressed run of key bytes, the slot pointing here consumes its own key byte followed by the segment
+        typedef struct {
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint64_t next_index_descriptor;
+            uint8_t length;
+            uint8_t segment[PREFIX_SEGMENT_SIZE];
+        } PREFIX_DESCRIPTOR;
         
+        // First NODE_ALIGN bytes of a version 2 store
         typedef struct {
+            uint32_t magic_flag;
+            uint32_t version;
+            uint32_t node_align;
+            uint32_t reserved;
+            uint64_t root;                  // Offset of the root index node
+            uint64_t node_extent;           // Extent new nodes are taken from
+            uint64_t node_next;             // Where the next node is allocated in node_extent, 0 if the rest of it is unused
+            uint8_t padding[24];
+        } SUPERBLOCK;
+        
+        // Version 2 index nodes fill two cache lines. Links to other nodes are node numbers, offset/NODE_ALIGN, with
+        // NODE_NUMBER_FLAG standing in for SLOT_PREFIX or NEXT_BANK_MAP. The low 31 bits of a number are kept in the
+        // link and the rest in its high word, which stays zero below 128 GiB. A slot with both zero is unused.
+        typedef struct {
+            uint32_t magic_flag;
+            uint8_t range_start;
+            uint8_t padding[3];
+            uint32_t next_index_descriptor;
+            uint32_t reserved;
+            uint64_t file;
+            uint32_t slot[BANK_SIZE];
+            uint16_t slot_high[BANK_SIZE];
+            uint16_t next_high;
+            uint8_t spare[6];
+        } COMPACT_INDEX_DESCRIPTOR;
+        
+        typedef struct {
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint32_t banks[256/BANK_SIZE];
+            uint16_t banks_high[256/BANK_SIZE];
+            uint8_t spare[24];
+        } COMPACT_BANK_MAP;
+        
+        // Loaded descriptors are taken from and returned to pools of their own type, shared by every store
+        struct LOADED_INDEX_DESCRIPTOR : public Pooled<LOADED_INDEX_DESCRIPTOR> {
             unsigned long long offset;
             INDEX_DESCRIPTOR descriptor;
-        } LOADED_INDEX_DESCRIPTOR;
+        };
         
         typedef struct {
-            unsigned long magic_flag;
-            unsigned long long first_data_block;
-            unsigned long long last_data_block;
-            unsigned long long file_size;
-            unsigned int block_size;
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint64_t first_data_block;
+            uint64_t last_data_block;
+            uint64_t file_size;
+            uint32_t block_size;
+            uint32_t block_count;           // Only maintained for indexed files
+            uint64_t block_index;           // Root BLOCK_INDEX node, 0 until the first block is created
+            uint32_t flags;                 // FILE_FLAG_* options
+            uint32_t padding;
         } FILE_DESCRIPTOR;
         
+        // Small values are kept after the descriptor, one read or write covers the whole value
         typedef struct {
+            FILE_DESCRIPTOR descriptor;     // Uses MAGIC_FLAG_VALUE_FILE, file_size is the length of the value
+            uint8_t data[INLINE_VALUE_SIZE];
+        } VALUE_RECORD;
+        
+        struct LOADED_FILE_DESCRIPTOR : public Pooled<LOADED_FILE_DESCRIPTOR> {
             unsigned long long offset;
             FILE_DESCRIPTOR descriptor;
-        } LOADED_FILE_DESCRIPTOR;
+        };
         
+        // In compressed files block_size is the space allocated for the block and used_bytes the length once decompressed.
+        // Blocks that did not compress are stored raw with the file's block_size.
         typedef struct {
-            unsigned long magic_flag;
-            unsigned long long next_data_block;
-            unsigned int block_size;
-            unsigned int used_bytes;
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint64_t next_data_block;
+            uint32_t block_size;
+            uint32_t used_bytes;
         } DATA_BLOCK_DESCRIPTOR;
         
-        typedef struct {
+        struct LOADED_DATA_BLOCK_DESCRIPTOR : public Pooled<LOADED_DATA_BLOCK_DESCRIPTOR> {
             unsigned long long offset;
             DATA_BLOCK_DESCRIPTOR descriptor;
             Memory data;
-        } LOADED_DATA_BLOCK_DESCRIPTOR;
+            std::vector< std::pair<unsigned int, unsigned int> > dirty; // Ranges of data not yet written, sorted and disjoint
+        };
 
-        typedef struct {
+        struct LOADED_BANK_MAP : public Pooled<LOADED_BANK_MAP> {
             unsigned long long offset;
             BANK_MAP descriptor;
-        } LOADED_BANK_MAP;
+        };
 
+        struct LOADED_PREFIX_DESCRIPTOR : public Pooled<LOADED_PREFIX_DESCRIPTOR> {
+            unsigned long long offset;
+            PREFIX_DESCRIPTOR descriptor;
+        };
+
+        // Radix of data block offsets, a node of depth 0 holds the data block offsets themselves
+        typedef struct {
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint32_t depth;
+            uint32_t padding;
+            uint64_t entry[BLOCK_INDEX_SIZE];
+        } BLOCK_INDEX;
+
+        struct LOADED_BLOCK_INDEX : public Pooled<LOADED_BLOCK_INDEX> {
+            unsigned long long offset;
+            BLOCK_INDEX descriptor;
+        };
+
+        // Released space is chained through its first bytes, one list per allocation size
+        typedef struct {
+            uint32_t magic_flag;
+            uint32_t reserved;
+            uint64_t next;
+        } FREE_BLOCK;
+
+        // Free list heads, stored as the contents of the recycled blocks file
+        typedef struct {
+            uint64_t size;
+            uint64_t head;
+            uint64_t count;
+        } FREE_LIST;
+        
+        typedef struct {
+            unsigned long long files;           // Files copied so far
+            unsigned long long total_files;
+            unsigned long long bytes;           // File data copied so far
+            unsigned long long original_size;   // Store size before compaction
+            unsigned long long compacted_size;  // Size of the new store, only known once finished
+            double elapsed;                     // Seconds since compaction started
+            double bytes_per_second;
+        } COMPACT_STATS;
+        
+        typedef void (*CompactProgress)(const COMPACT_STATS *stats, void *context);
+        
+        // Counts since the store was opened or the last resetStats. Only the cache counters are kept when built
+        // with --disable-stats, everything else reads as zero.
+        typedef struct {
+            unsigned long long lookups;             // Key descents through the trie
+            unsigned long long filter_rejects;      // Lookups answered by the key filter without a descent
+            unsigned long long descriptor_reads;    // Descriptors read, whether from the mapping, cache or store
+            unsigned long long cache_hits;
+            unsigned long long cache_misses;
+            unsigned long long chain_hops;          // next_data_block links followed
+            unsigned long long reads;
+            unsigned long long bytes_requested;     // Bytes asked for by file reads
+            unsigned long long bytes_read;          // Bytes they returned
+            unsigned long long writes;
+            unsigned long long bytes_written;
+            unsigned long long commits;
+            LATENCY_HISTOGRAM lookup_latency;
+            LATENCY_HISTOGRAM read_latency;
+            LATENCY_HISTOGRAM write_latency;
+            LATENCY_HISTOGRAM commit_latency;
+            File::FILE_STATS file;
+        } STORE_STATS;
+        
+        // Pools of loaded descriptors, shared by every store in the process
+        typedef struct {
+            ObjectPool::USAGE index_descriptors;
+            ObjectPool::USAGE prefix_descriptors;
+            ObjectPool::USAGE bank_maps;
+            ObjectPool::USAGE file_descriptors;
+            ObjectPool::USAGE data_blocks;      // Descriptors only, the data of a block is allocated with it
+            ObjectPool::USAGE block_indexes;
+            unsigned long long bytes;           // Held by all the pools, in use or pooled
+        } POOL_USAGE;
+        
+        // Data is only valid for the duration of the call, return false to stop visiting
+        typedef bool (*BlockVisitor)(const char *data, size_t length, unsigned long long offset, void *context);
+        
+        // Descriptor reached after position bytes of a key, a path of these lets the next key resume from a shared prefix
         typedef struct {
-            Memory key;
+            size_t position;
             Ref<LOADED_INDEX_DESCRIPTOR> desc;
-        } ITERATION_DESC;
+        } PATH_ENTRY;
         
     public:
-        IndexedDataStore(String path);
+        // Depth first walk over the keys starting with a prefix, in key order. Nothing is allocated per step,
+        // the key and file descriptor are reused and only valid until the next call to next(). The walk holds
+        // offsets of index nodes between calls, so a cursor is invalid once anything writes to the store and
+        // next() then throws "Store modified". Keys to change are collected first and written after the walk.
+        class Cursor {
+        public:
+            Cursor(IndexedDataStore *store, Memory prefix);
+            
+            bool next();
+            const char* getKey();
+            size_t getKeyLength();
+            Ref<LOADED_FILE_DESCRIPTOR> getFile();
+            
+        private:
+            typedef struct {
+                unsigned long long slots[256];  // Slots of the descriptor and all its siblings
+                int next_index;
+                size_t key_length;              // Length of the key at this descriptor
+            } FRAME;
+            
+            IndexedDataStore *store;
+            unsigned long long modifications;   // Store's modification count when the walk started
+            std::vector<FRAME> frames;
+            size_t depth;
+            std::vector<unsigned char> key;
+            Ref<LOADED_FILE_DESCRIPTOR> file;
+            bool emit_start;
+            
+            INDEX_DESCRIPTOR node;
+            PREFIX_DESCRIPTOR prefix;
+            
+            unsigned long long push(unsigned long long offset);
+            bool loadFile(unsigned long long offset);
+        };
+        
+        // Mapped stores read descriptors directly from a memory mapping of the store and do not use the descriptor cache.
+        // A store may be shared by threads, reads run together while every write, and every batch from beginBatch
+        // to its commit or rollback, has the store to itself.
+        IndexedDataStore(String path, size_t cache_size=DESCRIPTOR_CACHE_SIZE, bool mapped=false);
         virtual ~IndexedDataStore();
         
-        Ref<LOADED_FILE_DESCRIPTOR> createFile(Memory key, unsigned int block_size);
+        // flags takes FILE_FLAG_COMPRESSED to store each block compressed, reads and writes stay block granular
+        Ref<LOADED_FILE_DESCRIPTOR> createFile(Memory key, unsigned int block_size, unsigned int flags=0);
+        
+        // Keys are checked against an in memory filter first, so most keys that were never written are answered
+        // without reading the store. getFile throws when the key has no file, tryGetFile returns an empty Ref.
         Ref<LOADED_FILE_DESCRIPTOR> getFile(Memory key);
+        Ref<LOADED_FILE_DESCRIPTOR> tryGetFile(Memory key);
+        
+        Ref<LOADED_FILE_DESCRIPTOR> getOrCreateFile(Memory key, unsigned int block_size, unsigned int flags=0);
         
-        Ref<LOADED_FILE_DESCRIPTOR> getOrCreateFile(Memory key, unsigned int block_size);
+        // Space is returned to the recycled blocks free lists, descriptors still held for the file are invalid afterwards
+        bool deleteFile(Memory key);
+        bool truncateFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long size);
         
+        // Writing past the end of the file leaves a gap that reads back as zeros
         bool writeToFile(Ref<LOADED_FILE_DESCRIPTOR> file, Memory data, unsigned long long offset, unsigned long long length);
+        bool writeToFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length);
         unsigned long long getFileSize(Ref<LOADED_FILE_DESCRIPTOR> file);
         Memory readFromFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length);
         
-        void set(Memory key, Memory value);
-        void set(Memory key, int value);
-        void set(Memory key, unsigned int value);
-        void set(Memory key, long long value);
-        void set(Memory key, unsigned long long value);
+        // Reads into the caller's buffer or visits the data block by block without copying it, both return the bytes covered
+        unsigned long long readFromFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, char *buffer, unsigned long long length);
+        unsigned long long visitFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, BlockVisitor visitor, void *context=0);
         
+        void set(Memory key, Memory value);
         Memory read(Memory key, unsigned int length);
+        Memory readOrSet(Memory key, Memory default_value);
+        
+        // Typed values are copied straight between the value and its VALUE_RECORD, they are limited to
+        // INLINE_VALUE_SIZE so they are always kept in one. A stored value shorter than T reads back zero filled.
+        template <class T>
+        struct IsStoredValue {
+            static const bool value = std::is_trivially_copyable<T>::value && !std::is_pointer<T>::value && !std::is_array<T>::value;
+        };
+        
+        template <class T>
+        typename std::enable_if<IsStoredValue<T>::value>::type set(Memory key, const T &value) {
+            static_assert(sizeof(T) <= INLINE_VALUE_SIZE, "Typed values must fit in a VALUE_RECORD");
+            setValue(key, &value, sizeof(T));
+        }
+        
+        template <class T>
+        typename std::enable_if<IsStoredValue<T>::value, T>::type get(Memory key) {
+            static_assert(sizeof(T) <= INLINE_VALUE_SIZE, "Typed values must fit in a VALUE_RECORD");
+            T value;
+            readValue(key, &value, sizeof(T));
+            return value;
+        }
+        
+        template <class T>
+        typename std::enable_if<IsStoredValue<T>::value, T>::type readOrSet(Memory key, const T &default_value) {
+            static_assert(sizeof(T) <= INLINE_VALUE_SIZE, "Typed values must fit in a VALUE_RECORD");
+            T value;
+            readOrSetValue(key, &default_value, &value, sizeof(T));
+            return value;
+        }
+        
         int readInt(Memory key);
         long long readLongLong(Memory key);
         
-        Memory readOrSet(Memory key, Memory default_value);
-        int readOrSet(Memory key, int default_value);
-        unsigned int readOrSet(Memory key, unsigned int default_value);
-        long long readOrSet(Memory key, long long default_value);
-        unsigned long long readOrSet(Memory key, unsigned long long default_value);
+        // Keys are visited in sorted order so shared prefixes are only walked once, the data is then read or
+        // written in store offset order, unmapped stores queue all of the reads on AsyncIO at once. readMany returns
+        // the values in the order of keys, missing keys read as empty.
+        void setMany(Array<Memory> &keys, Array<Memory> &values);
+        Array<Memory> readMany(Array<Memory> &keys, unsigned int length);
+
+        // Stores are created in the current format, older stores are used as they are until upgraded. The upgrade copies
+        // the index into version 2 nodes at the end of the store and switches to them with a single superblock write,
+        // index descriptors held by the caller are stale afterwards.
+        unsigned int getFormatVersion();
+        bool upgradeFormat(); // false if the store is already current
 
-        bool convertDescriptorListToBankMap(Memory key); // Needs to be debuged, works but not time proven
+        bool convertDescriptorListToBankMap(Memory key); // Nodes are converted once they chain BANK_MAP_THRESHOLD descriptors, false if key's node already has a map
 
-        RefArray<int> getChildIndexes(Memory key);
+        RefArray<int> getChildIndexes(Memory key); // Child key bytes in ascending order, terminated by -1
+        Cursor scan(Memory prefix);
+
+        // Writes made between beginBatch and commit reach the store as one write ahead log record, batches may be nested.
+        // rollback only undoes the writes of the innermost batch, the enclosing batch carries on and commits the rest.
+        // Descriptors held by the caller are not restored by rollback. Other threads are locked out until the batch ends.
+        void beginBatch();
+        void commit();
+        void rollback();
+
+        // Descriptor cache, a size of 0 disables caching
+        void setCacheSize(size_t entries);
+        unsigned long long getCacheHits();
+        unsigned long long getCacheMisses();
+        
+        STORE_STATS getStats();
+        void resetStats();
+        
+        static POOL_USAGE getPoolUsage();
+        static void trimPools(); // Returns pooled descriptors to the heap
+        
+        // Rewrites the store into <path>.compact with the trie nodes clustered breadth first and the blocks of each
+        // file contiguous, then renames it over the store. Descriptors held by the caller are invalid afterwards.
+        COMPACT_STATS compact(CompactProgress progress=0, void *context=0);
 
     private:
+        // Lookups and reads share the lock, everything that modifies the store takes it exclusively
+        ReadWriteLock lock;
+        
+        String path;
         File file;
+        DescriptorCache cache;
+        BloomFilter filter;     // Every key given a file since the store was opened or the filter last rebuilt
+        WriteAheadLog wal;
+        int batch_depth;
+        unsigned long long modifications; // Counts writes to the store, open cursors compare it
+        
+        unsigned int format_version;
+        unsigned long long root_offset;
+        unsigned long long node_extent;
+        unsigned long long node_next;
+        unsigned long long superblock_next; // node_next as the superblock on disk has it
+        unsigned long long batch_node_extent; // node_extent and node_next when the outermost batch began
+        unsigned long long batch_node_next;
+        
+#if !STATS_DISABLED
+        struct {
+            StatsCounter lookups;
+            StatsCounter filter_rejects;
+            StatsCounter descriptor_reads;
+            StatsCounter chain_hops;
+            StatsCounter reads;
+            StatsCounter bytes_requested;
+            StatsCounter bytes_read;
+            StatsCounter writes;
+            StatsCounter bytes_written;
+            StatsCounter commits;
+            StatsHistogram lookup_latency;
+            StatsHistogram read_latency;
+            StatsHistogram write_latency;
+            StatsHistogram commit_latency;
+        } stats;
+#endif
+        
+        Ref<LOADED_FILE_DESCRIPTOR> recycled_blocks;
+        std::vector<FREE_LIST> free_lists;
+        std::unordered_map<unsigned long long, unsigned int> free_list_index; // Allocation size to free_lists entry
+        std::unordered_map<unsigned long long, unsigned long long> upgraded_files; // Legacy descriptor offset to the descriptor it was moved to
+        
+        void openSuperblock();
+        void openRecycledBlocks();
+        unsigned long long allocate(size_t size, bool recycle=true);
+        unsigned long long allocateNode(size_t size);
+        void reserveNodeExtent();
+        void writeSuperblock(unsigned long long next);
+        unsigned long long popFreeList(unsigned long long size);
+        void release(unsigned long long offset, unsigned long long size);
+        void releaseNode(unsigned long long offset, size_t size);
+        void updateFreeList(unsigned int index);
         
-        Ref<LOADED_INDEX_DESCRIPTOR> getChildDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index);
+        Memory readRaw(unsigned long long offset, size_t length);
+        void writeRaw(unsigned long long offset, const char *data, size_t length);
+        void reserveRaw(unsigned long long end);
+        unsigned long long storeLength();
+        
+        void readDescriptor(unsigned long long offset, void *descriptor, size_t length);
+        void writeDescriptor(unsigned long long offset, const void *descriptor, size_t length);
+        
+        // Index and bank map nodes in the layout of the store's format version
+        void readIndexNode(unsigned long long offset, INDEX_DESCRIPTOR *descriptor);
+        void writeIndexNode(unsigned long long offset, const INDEX_DESCRIPTOR *descriptor);
+        void readBankNode(unsigned long long offset, BANK_MAP *bmap);
+        void writeBankNode(unsigned long long offset, const BANK_MAP *bmap);
+        size_t indexNodeSize();
+        size_t bankNodeSize();
+        
+        unsigned long long upgradeIndexNode(unsigned long long offset, std::vector< std::pair<unsigned long long, size_t> > &released);
+        unsigned long long upgradePrefixNode(unsigned long long offset, std::vector< std::pair<unsigned long long, size_t> > &released);
+        
+        Ref<LOADED_INDEX_DESCRIPTOR> findDescriptor(Memory key, bool create, int *pending=0, std::vector<PATH_ENTRY> *path=0);
+        Ref<LOADED_INDEX_DESCRIPTOR> findValue(Memory key); // Throws for missing keys
+        bool readValueRecord(unsigned long long offset, VALUE_RECORD *record); // false for files that are not value records
+        void setValue(Memory key, const void *value, size_t length);
+        unsigned long long readValue(Memory key, void *value, size_t length);
+        void readOrSetValue(Memory key, const void *default_value, void *value, size_t length);
+        Ref<LOADED_INDEX_DESCRIPTOR> getSlotDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index);
+        Ref<LOADED_INDEX_DESCRIPTOR> createIndexDescriptor(unsigned char range_start);
+        Ref<LOADED_INDEX_DESCRIPTOR> createKeyPath(Ref<LOADED_INDEX_DESCRIPTOR> owner, int slot, const unsigned char *segment, size_t length);
+        Ref<LOADED_INDEX_DESCRIPTOR> splitPrefix(Ref<LOADED_INDEX_DESCRIPTOR> owner, int slot, Ref<LOADED_PREFIX_DESCRIPTOR> prefix, unsigned int position);
         Ref<LOADED_INDEX_DESCRIPTOR> loadIndexDescriptor(unsigned long long offset);
         void updateIndexDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor);
 
+        Ref<LOADED_INDEX_DESCRIPTOR> getBankSlotDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> descriptor, unsigned char index, bool create_index);
         Ref<LOADED_BANK_MAP> loadBankMap(unsigned long long offset);
+        void createBankMap(Ref<LOADED_INDEX_DESCRIPTOR> head);
+        void updateBankMap(Ref<LOADED_BANK_MAP> bmap);
+
+        Ref<LOADED_PREFIX_DESCRIPTOR> loadPrefixDescriptor(unsigned long long offset);
+        Ref<LOADED_PREFIX_DESCRIPTOR> createPrefixDescriptor(const unsigned char *segment, size_t length, unsigned long long next);
+        void updatePrefixDescriptor(Ref<LOADED_PREFIX_DESCRIPTOR> prefix);
         
         Ref<LOADED_FILE_DESCRIPTOR> loadFileDescriptor(unsigned long long offset);
+        void readFileDescriptor(unsigned long long offset, FILE_DESCRIPTOR *descriptor);
+        unsigned long long createValueFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, Memory value);
+        unsigned long long createValueFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, const char *data, size_t length);
+        void writeValueFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length);
+        void convertValueFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+        Ref<LOADED_FILE_DESCRIPTOR> createKeyFile(Ref<LOADED_INDEX_DESCRIPTOR> desc, unsigned int block_size, unsigned int flags=0);
+        Ref<LOADED_FILE_DESCRIPTOR> loadKeyFile(Ref<LOADED_INDEX_DESCRIPTOR> desc);
+        Ref<LOADED_FILE_DESCRIPTOR> findFile(Memory key);
+        Ref<LOADED_FILE_DESCRIPTOR> lookupFile(Memory key);
+        void addToFilter(Memory key);
+        void rebuildFilter();
+        Memory readFileData(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length);
+        unsigned long long readFileRuns(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, char *buffer, BlockVisitor visitor, void *context, std::vector<AsyncIO::IO_REQUEST> *deferred=0);
+        unsigned long long readIndexedBlocks(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long length, char *buffer);
+        void completeReads(std::vector<AsyncIO::IO_REQUEST> &requests);
+        unsigned long long findDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long *block_offset, DATA_BLOCK_DESCRIPTOR *desc);
+        void readData(unsigned long long offset, char *buffer, size_t length);
+        std::vector<int> sortKeys(Array<Memory> &keys);
+        Ref<LOADED_INDEX_DESCRIPTOR> findSortedDescriptor(Memory key, Memory previous, bool create, std::vector<PATH_ENTRY> &path);
         void updateFileDescriptor(Ref<LOADED_FILE_DESCRIPTOR> descriptor);
         
         Ref<LOADED_DATA_BLOCK_DESCRIPTOR> loadDataDescriptor(unsigned long long offset);
         
         Ref<LOADED_DATA_BLOCK_DESCRIPTOR> createDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file, Ref<LOADED_DATA_BLOCK_DESCRIPTOR> previous);
+        void appendDataBlocks(Ref<LOADED_FILE_DESCRIPTOR> file, Ref<LOADED_DATA_BLOCK_DESCRIPTOR> previous, const char *data, unsigned long long length); // data may be 0 for hole blocks
+        void extendFile(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long size);
+        Ref<LOADED_DATA_BLOCK_DESCRIPTOR> seekDataBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long offset, unsigned long long *block_offset, bool create);
         void updateDataBlockDescriptor(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor);
         
-        void updateDataBlockData(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor);
+        void markDataBlockDirty(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor, unsigned int start, unsigned int end);
+        void updateDataBlockData(Ref<LOADED_DATA_BLOCK_DESCRIPTOR> descriptor, bool update_descriptor=false); // Writes the dirty ranges
+        
+        bool writeCompressedFile(Ref<LOADED_FILE_DESCRIPTOR> file, const char *data, unsigned long long offset, unsigned long long length);
+        unsigned long long storeCompressedBlock(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned int block_number, const char *data, unsigned int used);
+        void readBlockData(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned long long position, const DATA_BLOCK_DESCRIPTOR *desc, char *buffer);
+
+        bool isIndexedFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+        bool isValueFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+        bool isLegacyFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+        bool isCompressedFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+        void upgradeFileDescriptor(Ref<LOADED_INDEX_DESCRIPTOR> owner, Ref<LOADED_FILE_DESCRIPTOR> file);
+        void resolveFile(Ref<LOADED_FILE_DESCRIPTOR> file);
+
+        Ref<LOADED_BLOCK_INDEX> loadBlockIndex(unsigned long long offset);
+        Ref<LOADED_BLOCK_INDEX> createBlockIndex(unsigned int depth);
+        void updateBlockIndex(Ref<LOADED_BLOCK_INDEX> index);
+        Ref<LOADED_BLOCK_INDEX> getBlockIndexLeaf(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned int block_number, bool create);
+        unsigned long long getDataBlockOffset(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned int block_number);
+        void indexDataBlocks(Ref<LOADED_FILE_DESCRIPTOR> file, unsigned int first_block, const unsigned long long *blocks, unsigned int count);
+        bool releaseBlockIndex(unsigned long long offset, unsigned long long first_block, unsigned long long span, unsigned long long keep);
         
         Ref<LOADED_INDEX_DESCRIPTOR> getRootDecriptor();
         Ref<LOADED_INDEX_DESCRIPTOR> getSystemDecriptor();
@@ -0,0 +1,96 @@
+//
+//  ObjectPool.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "ObjectPool.h"
+
+namespace nrcore {
+
+    // Locks the pool for the rest of the enclosing scope
+    class PoolLock {
+    public:
+        PoolLock(pthread_mutex_t *mutex) : mutex(mutex) {
+            pthread_mutex_lock(mutex);
+        }
+        
+        ~PoolLock() {
+            pthread_mutex_unlock(mutex);
+        }
+        
+    private:
+        pthread_mutex_t *mutex;
+    };
+
+    ObjectPool::ObjectPool(size_t object_size, size_t max_free) : object_size(object_size), max_free(max_free), in_use(0), allocations(0), reuses(0) {
+        pthread_mutex_init(&mutex, 0);
+        free_objects.reserve(max_free);
+    }
+
+    ObjectPool::~ObjectPool() {
+        trim();
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void *ObjectPool::allocate() {
+        {
+            PoolLock lock(&mutex);
+            in_use++;
+            
+            if (!free_objects.empty()) {
+                void *object = free_objects.back();
+                free_objects.pop_back();
+                reuses++;
+                return object;
+            }
+            
+            allocations++;
+        }
+        
+        return ::operator new(object_size);
+    }
+
+    void ObjectPool::release(void *object) {
+        if (!object)
+            return;
+        
+        {
+            PoolLock lock(&mutex);
+            in_use--;
+            
+            if (free_objects.size() < max_free) {
+                free_objects.push_back(object);
+                return;
+            }
+        }
+        
+        ::operator delete(object);
+    }
+
+    void ObjectPool::trim() {
+        std::vector<void*> objects;
+        {
+            PoolLock lock(&mutex);
+            objects.swap(free_objects);
+            free_objects.reserve(max_free);
+        }
+        
+        for (size_t i=0; i<objects.size(); i++)
+            ::operator delete(objects[i]);
+    }
+
+    ObjectPool::USAGE ObjectPool::getUsage() {
+        PoolLock lock(&mutex);
+        USAGE usage;
+        usage.object_size = object_size;
+        usage.in_use = in_use;
+        usage.pooled = free_objects.size();
+        usage.allocations = allocations;
+        usage.reuses = reuses;
+        return usage;
+    }
+
+}
@@ -0,0 +1,81 @@
+//
+//  ObjectPool.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef ObjectPool_hpp
+#define ObjectPool_hpp
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include <new>
+#include <vector>
+
+#define OBJECT_POOL_MAX_FREE    1024    // Released objects kept for reuse by each pool, the rest go back to the heap
+
+namespace nrcore {
+
+    // Free list of objects of one size, objects released to it are handed out again before the heap is used.
+    // Safe to share between threads.
+    class ObjectPool {
+    public:
+        typedef struct {
+            unsigned long long object_size;
+            unsigned long long in_use;
+            unsigned long long pooled;      // Released and waiting to be reused
+            unsigned long long allocations; // Objects taken from the heap
+            unsigned long long reuses;      // Objects taken from the pool
+        } USAGE;
+        
+        ObjectPool(size_t object_size, size_t max_free=OBJECT_POOL_MAX_FREE);
+        virtual ~ObjectPool();
+        
+        void *allocate();
+        void release(void *object);
+        void trim(); // Returns every pooled object to the heap
+        
+        USAGE getUsage();
+        
+    private:
+        pthread_mutex_t mutex;
+        
+        size_t object_size;
+        size_t max_free;
+        std::vector<void*> free_objects;
+        
+        unsigned long long in_use;
+        unsigned long long allocations;
+        unsigned long long reuses;
+    };
+
+    // Base for types that are allocated from a pool of their own, new and delete of T go through getPool()
+    template <class T>
+    class Pooled {
+    public:
+        static void *operator new(size_t size) {
+            if (size != sizeof(T))
+                return ::operator new(size);
+            return getPool().allocate();
+        }
+        
+        static void operator delete(void *object, size_t size) {
+            if (size != sizeof(T))
+                ::operator delete(object);
+            else
+                getPool().release(object);
+        }
+        
+        static ObjectPool &getPool() {
+            // Never destroyed, objects held in statics may still be released while the process exits
+            static ObjectPool *pool = new ObjectPool(sizeof(T));
+            return *pool;
+        }
+    };
+
+}
+
+#endif /* ObjectPool_hpp */
@@ -0,0 +1,75 @@
+//
+//  ReadWriteLock.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "ReadWriteLock.h"
+
+namespace nrcore {
+
+    ReadWriteLock::ReadWriteLock() : writing(false), writer(pthread_t()), write_depth(0) {
+        if (pthread_rwlock_init(&lock, 0) != 0)
+            throw "Failed to create lock";
+    }
+
+    ReadWriteLock::~ReadWriteLock() {
+        pthread_rwlock_destroy(&lock);
+    }
+
+    void ReadWriteLock::readLock() {
+        if (pthread_rwlock_rdlock(&lock) != 0)
+            throw "Failed to lock";
+    }
+
+    void ReadWriteLock::readUnlock() {
+        pthread_rwlock_unlock(&lock);
+    }
+
+    void ReadWriteLock::writeLock() {
+        if (isWriter()) {
+            write_depth++;
+            return;
+        }
+        
+        if (pthread_rwlock_wrlock(&lock) != 0)
+            throw "Failed to lock";
+        
+        writer = pthread_self();
+        writing = true;
+        write_depth = 1;
+    }
+
+    void ReadWriteLock::writeUnlock() {
+        if (--write_depth)
+            return;
+        
+        writing = false;
+        pthread_rwlock_unlock(&lock);
+    }
+
+    bool ReadWriteLock::isWriter() {
+        return writing && pthread_equal(writer, pthread_self());
+    }
+
+    ReadWriteLock::Reader::Reader(ReadWriteLock &lock) : lock(lock), locked(!lock.isWriter()) {
+        if (locked)
+            lock.readLock();
+    }
+
+    ReadWriteLock::Reader::~Reader() {
+        if (locked)
+            lock.readUnlock();
+    }
+
+    ReadWriteLock::Writer::Writer(ReadWriteLock &lock) : lock(lock) {
+        lock.writeLock();
+    }
+
+    ReadWriteLock::Writer::~Writer() {
+        lock.writeUnlock();
+    }
+
+}
@@ -0,0 +1,62 @@
+//
+//  ReadWriteLock.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef ReadWriteLock_hpp
+#define ReadWriteLock_hpp
+
+#include <pthread.h>
+
+#include <atomic>
+
+namespace nrcore {
+
+    // Any number of readers, or one writer with nobody else. A writer waits for the readers inside to leave and
+    // keeps every other thread out until it unlocks, nothing reads alongside a write. The writer may lock again
+    // recursively, and read locks taken by the thread holding the write lock are no-ops.
+    class ReadWriteLock {
+    public:
+        ReadWriteLock();
+        virtual ~ReadWriteLock();
+        
+        void readLock();
+        void readUnlock();
+        void writeLock();
+        void writeUnlock();
+        
+        bool isWriter(); // True when the calling thread holds the write lock
+        
+        // Lock for the lifetime of the guard, released if an exception leaves the scope
+        class Reader {
+        public:
+            Reader(ReadWriteLock &lock);
+            ~Reader();
+            
+        private:
+            ReadWriteLock &lock;
+            bool locked;
+        };
+        
+        class Writer {
+        public:
+            Writer(ReadWriteLock &lock);
+            ~Writer();
+            
+        private:
+            ReadWriteLock &lock;
+        };
+        
+    private:
+        pthread_rwlock_t lock;
+        std::atomic<bool> writing;
+        std::atomic<pthread_t> writer;
+        unsigned int write_depth;
+    };
+
+}
+
+#endif /* ReadWriteLock_hpp */
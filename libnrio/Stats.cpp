@@ -0,0 +1,99 @@
+//
+//  Stats.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "Stats.h"
+
+#include <string.h>
+
+namespace nrcore {
+
+    StatsCounter::StatsCounter() : value(0) {
+    }
+
+    StatsCounter::StatsCounter(const StatsCounter &counter) : value(counter.get()) {
+    }
+
+    StatsCounter& StatsCounter::operator =(const StatsCounter &counter) {
+        value.store(counter.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    void StatsCounter::add(unsigned long long n) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    unsigned long long StatsCounter::get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    void StatsCounter::reset() {
+        value.store(0, std::memory_order_relaxed);
+    }
+
+    StatsHistogram::StatsHistogram() : max_ns(0) {
+    }
+
+    StatsHistogram::StatsHistogram(const StatsHistogram &histogram) : count(histogram.count), total_ns(histogram.total_ns), max_ns(histogram.max_ns.load(std::memory_order_relaxed)) {
+        for (int i=0; i<STATS_HISTOGRAM_BUCKETS; i++)
+            buckets[i] = histogram.buckets[i];
+    }
+
+    StatsHistogram& StatsHistogram::operator =(const StatsHistogram &histogram) {
+        count = histogram.count;
+        total_ns = histogram.total_ns;
+        max_ns.store(histogram.max_ns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (int i=0; i<STATS_HISTOGRAM_BUCKETS; i++)
+            buckets[i] = histogram.buckets[i];
+        return *this;
+    }
+
+    void StatsHistogram::record(unsigned long long ns) {
+        int bucket = 0;
+        while (bucket < STATS_HISTOGRAM_BUCKETS-1 && ns >> (bucket+1))
+            bucket++;
+        
+        count.add(1);
+        total_ns.add(ns);
+        buckets[bucket].add(1);
+        
+        unsigned long long max = max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void StatsHistogram::snapshot(LATENCY_HISTOGRAM *histogram) const {
+        histogram->count = count.get();
+        histogram->total_ns = total_ns.get();
+        histogram->max_ns = max_ns.load(std::memory_order_relaxed);
+        for (int i=0; i<STATS_HISTOGRAM_BUCKETS; i++)
+            histogram->buckets[i] = buckets[i].get();
+    }
+
+    void StatsHistogram::reset() {
+        count.reset();
+        total_ns.reset();
+        max_ns.store(0, std::memory_order_relaxed);
+        for (int i=0; i<STATS_HISTOGRAM_BUCKETS; i++)
+            buckets[i].reset();
+    }
+
+    StatsTimer::StatsTimer(StatsHistogram *histogram) : histogram(histogram) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    StatsTimer::~StatsTimer() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        histogram->record((now.tv_sec-start.tv_sec)*1000000000ULL + now.tv_nsec - start.tv_nsec);
+    }
+
+    void clearHistogram(LATENCY_HISTOGRAM *histogram) {
+        memset(histogram, 0, sizeof(LATENCY_HISTOGRAM));
+    }
+
+}
@@ -0,0 +1,86 @@
+//
+//  Stats.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef Stats_hpp
+#define Stats_hpp
+
+#include "config.h"
+
+#include <time.h>
+
+#include <atomic>
+
+#define STATS_HISTOGRAM_BUCKETS 32
+
+// Instrumentation sites use these so --disable-stats removes them, and the counters they touch, entirely
+#if STATS_DISABLED
+#define STATS_COUNT(counter, n)
+#define STATS_TIME(histogram)
+#else
+#define STATS_COUNT(counter, n) (counter).add(n)
+#define STATS_TIME(histogram) StatsTimer stats_timer(&(histogram))
+#endif
+
+namespace nrcore {
+
+    // Bucket i counts operations that took from 2^i up to 2^(i+1) nanoseconds, the last bucket everything slower
+    typedef struct {
+        unsigned long long count;
+        unsigned long long total_ns;
+        unsigned long long max_ns;
+        unsigned long long buckets[STATS_HISTOGRAM_BUCKETS];
+    } LATENCY_HISTOGRAM;
+
+    // Relaxed atomics, updates from several threads are never lost but a snapshot is not taken at a single instant
+    class StatsCounter {
+    public:
+        StatsCounter();
+        StatsCounter(const StatsCounter &counter);
+        StatsCounter& operator =(const StatsCounter &counter);
+        
+        void add(unsigned long long n);
+        unsigned long long get() const;
+        void reset();
+        
+    private:
+        std::atomic<unsigned long long> value;
+    };
+
+    class StatsHistogram {
+    public:
+        StatsHistogram();
+        StatsHistogram(const StatsHistogram &histogram);
+        StatsHistogram& operator =(const StatsHistogram &histogram);
+        
+        void record(unsigned long long ns);
+        void snapshot(LATENCY_HISTOGRAM *histogram) const;
+        void reset();
+        
+    private:
+        StatsCounter count;
+        StatsCounter total_ns;
+        std::atomic<unsigned long long> max_ns;
+        StatsCounter buckets[STATS_HISTOGRAM_BUCKETS];
+    };
+
+    // Records the time from construction to destruction
+    class StatsTimer {
+    public:
+        StatsTimer(StatsHistogram *histogram);
+        ~StatsTimer();
+        
+    private:
+        StatsHistogram *histogram;
+        struct timespec start;
+    };
+
+    void clearHistogram(LATENCY_HISTOGRAM *histogram);
+
+}
+
+#endif /* Stats_hpp */
@@ -25,6 +25,7 @@
 #include "Stream.h"
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 namespace nrcore {
 
@@ -57,8 +58,12 @@ namespace nrcore {
         if (fd<0)
             return 0;
         
+        STATS_TIME(stats.write_latency);
         ssize_t ret = ::write(fd, buf, sz);
         fsync(fd);
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.syncs, 1);
+        STATS_COUNT(stats.bytes_written, ret > 0 ? ret : 0);
         return ret;
     }
 
@@ -66,7 +71,67 @@ namespace nrcore {
         if (fd < 0)
             return 0;
         
-        return ::read(fd, buf, sz);
+        STATS_TIME(stats.read_latency);
+        ssize_t ret = ::read(fd, buf, sz);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, sz);
+        STATS_COUNT(stats.bytes_read, ret > 0 ? ret : 0);
+        return ret;
+    }
+
+    void Stream::readAsync(AsyncIO::IO_REQUEST *request, char* buf, size_t sz, AsyncIO::Callback callback, void *context) {
+        AsyncIO::prepare(request, fd, ASYNC_IO_READ, reserve(sz), buf, sz, callback, context);
+        STATS_COUNT(stats.reads, 1);
+        STATS_COUNT(stats.bytes_requested, sz);
+        AsyncIO::getShared().submit(request);
+    }
+
+    void Stream::writeAsync(AsyncIO::IO_REQUEST *request, const char* buf, size_t sz, AsyncIO::Callback callback, void *context) {
+        // Synced like write
+        AsyncIO::prepare(request, fd, ASYNC_IO_WRITE | ASYNC_IO_SYNC, reserve(sz), (char*)buf, sz, callback, context);
+        STATS_COUNT(stats.writes, 1);
+        STATS_COUNT(stats.syncs, 1);
+        AsyncIO::getShared().submit(request);
+    }
+
+    long long Stream::reserve(size_t sz) {
+        off_t position = lseek(fd, 0, SEEK_CUR);
+        if (position == -1)
+            return -1;
+        
+        lseek(fd, sz, SEEK_CUR);
+        return position;
+    }
+
+    Stream::STREAM_STATS Stream::getStats() const {
+        STREAM_STATS ret;
+        memset(&ret, 0, sizeof(STREAM_STATS));
+        
+#if !STATS_DISABLED
+        ret.reads = stats.reads.get();
+        ret.bytes_requested = stats.bytes_requested.get();
+        ret.bytes_read = stats.bytes_read.get();
+        ret.writes = stats.writes.get();
+        ret.bytes_written = stats.bytes_written.get();
+        ret.syncs = stats.syncs.get();
+        stats.read_latency.snapshot(&ret.read_latency);
+        stats.write_latency.snapshot(&ret.write_latency);
+#endif
+        
+        return ret;
+    }
+
+    void Stream::resetStats() {
+#if !STATS_DISABLED
+        stats.reads.reset();
+        stats.bytes_requested.reset();
+        stats.bytes_read.reset();
+        stats.writes.reset();
+        stats.bytes_written.reset();
+        stats.syncs.reset();
+        stats.read_latency.reset();
+        stats.write_latency.reset();
+#endif
     }
 
 };
@@ -27,10 +27,25 @@
 
 #include <libnrcore/types.h>
 
+#include "Stats.h"
+#include "AsyncIO.h"
+
 namespace nrcore {
 
     class Stream {
     public:
+        // Counts since the stream was created or the last resetStats, all zero when built with --disable-stats
+        typedef struct {
+            unsigned long long reads;
+            unsigned long long bytes_requested;
+            unsigned long long bytes_read;
+            unsigned long long writes;
+            unsigned long long bytes_written;
+            unsigned long long syncs;
+            LATENCY_HISTOGRAM read_latency;
+            LATENCY_HISTOGRAM write_latency;
+        } STREAM_STATS;
+        
         Stream(int fd);
         Stream(const Stream& stream);
         virtual ~Stream();
@@ -39,11 +54,35 @@ namespace nrcore {
         virtual ssize_t read(char* buf, size_t sz);
         virtual void close();
         
+        // Queued on the shared AsyncIO, the request completes in the background and is collected with AsyncIO::wait
+        // or the callback. Seekable streams are advanced past the request straight away so further requests follow
+        // it, pipes and sockets transfer in submission order only while one request is outstanding.
+        virtual void readAsync(AsyncIO::IO_REQUEST *request, char* buf, size_t sz, AsyncIO::Callback callback=0, void *context=0);
+        virtual void writeAsync(AsyncIO::IO_REQUEST *request, const char* buf, size_t sz, AsyncIO::Callback callback=0, void *context=0);
+        
         int getFd();
         bool isValid();
         
+        STREAM_STATS getStats() const;
+        void resetStats();
+        
     protected:
         int fd;
+        
+        long long reserve(size_t sz);
+        
+#if !STATS_DISABLED
+        struct {
+            StatsCounter reads;
+            StatsCounter bytes_requested;
+            StatsCounter bytes_read;
+            StatsCounter writes;
+            StatsCounter bytes_written;
+            StatsCounter syncs;
+            StatsHistogram read_latency;
+            StatsHistogram write_latency;
+        } stats;
+#endif
     };
     
 };
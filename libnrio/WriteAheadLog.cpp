@@ -0,0 +1,284 @@
+//
+//  WriteAheadLog.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include "WriteAheadLog.h"
+
+#include <string.h>
+#include <unistd.h>
+
+namespace nrcore {
+
+    WriteAheadLog::WriteAheadLog(const char *store_path) : fp(0), log_size(0), pending_end(0), reserved_end(0) {
+        char *buf = new char[strlen(store_path)+5];
+        sprintf(buf, "%s.wal", store_path);
+        path = buf;
+        delete[] buf;
+    }
+
+    WriteAheadLog::~WriteAheadLog() {
+        if (fp)
+            fclose(fp);
+    }
+
+    void WriteAheadLog::write(unsigned long long offset, const char *data, size_t length) {
+        if (!length)
+            return;
+        
+        unsigned long long end = offset+length;
+        std::map<unsigned long long, Memory>::iterator first = pending.upper_bound(offset);
+        
+        if (first != pending.begin()) {
+            std::map<unsigned long long, Memory>::iterator prev = first;
+            prev--;
+            
+            // Rewrites of a range already in the batch, such as a descriptor being updated again
+            if (prev->first+prev->second.length() >= end && savepoints.empty()) {
+                memcpy(prev->second.operator char *()+(offset-prev->first), data, length);
+                return;
+            }
+            
+            if (prev->first+prev->second.length() > offset)
+                first = prev;
+        }
+        
+        unsigned long long start = first == pending.end() || offset < first->first ? offset : first->first;
+        unsigned long long stop = end;
+        std::map<unsigned long long, Memory>::iterator last = first;
+        while (last != pending.end() && last->first < end) {
+            if (last->first+last->second.length() > stop)
+                stop = last->first+last->second.length();
+            last++;
+        }
+        
+        Memory merged(stop-start);
+        for (std::map<unsigned long long, Memory>::iterator it = first; it != last; it++)
+            memcpy(merged.operator char *()+(it->first-start), it->second.operator char *(), it->second.length());
+        memcpy(merged.operator char *()+(offset-start), data, length);
+        
+        pending.erase(first, last);
+        pending[start] = merged;
+        
+        if (stop > pending_end)
+            pending_end = stop;
+    }
+
+    void WriteAheadLog::reserve(unsigned long long end) {
+        if (end > reserved_end)
+            reserved_end = end;
+        if (end > pending_end)
+            pending_end = end;
+    }
+
+    void WriteAheadLog::overlay(unsigned long long offset, char *buffer, size_t length) {
+        unsigned long long end = offset+length;
+        std::map<unsigned long long, Memory>::iterator it = pending.upper_bound(offset);
+        if (it != pending.begin())
+            it--;
+        
+        for (; it != pending.end() && it->first < end; it++) {
+            unsigned long long s = it->first > offset ? it->first : offset;
+            unsigned long long e = it->first+it->second.length() < end ? it->first+it->second.length() : end;
+            if (s < e)
+                memcpy(buffer+(s-offset), it->second.operator char *()+(s-it->first), e-s);
+        }
+    }
+
+    unsigned long long WriteAheadLog::getEnd() {
+        return pending_end;
+    }
+
+    bool WriteAheadLog::hasPendingWrites() {
+        return !pending.empty() || reserved_end;
+    }
+
+    void WriteAheadLog::discard() {
+        pending.clear();
+        pending_end = 0;
+        reserved_end = 0;
+        savepoints.clear();
+    }
+
+    void WriteAheadLog::mark() {
+        SAVEPOINT savepoint;
+        savepoint.pending = pending;
+        savepoint.pending_end = pending_end;
+        savepoint.reserved_end = reserved_end;
+        savepoints.push_back(savepoint);
+    }
+
+    void WriteAheadLog::releaseMark() {
+        if (!savepoints.empty())
+            savepoints.pop_back();
+    }
+
+    void WriteAheadLog::rollbackToMark() {
+        if (savepoints.empty()) {
+            discard();
+            return;
+        }
+        
+        pending = savepoints.back().pending;
+        pending_end = savepoints.back().pending_end;
+        reserved_end = savepoints.back().reserved_end;
+        savepoints.pop_back();
+    }
+
+    void WriteAheadLog::commit(File &file) {
+        if (!hasPendingWrites())
+            return;
+        
+        size_t size = sizeof(RECORD);
+        if (reserved_end)
+            size += sizeof(ENTRY);
+        for (std::map<unsigned long long, Memory>::iterator it = pending.begin(); it != pending.end(); it++)
+            size += sizeof(ENTRY)+it->second.length();
+        
+        Memory record(size);
+        char *pos = record.operator char *()+sizeof(RECORD);
+        if (reserved_end) {
+            ENTRY entry = {reserved_end, 0};
+            memcpy(pos, &entry, sizeof(ENTRY));
+            pos += sizeof(ENTRY);
+        }
+        for (std::map<unsigned long long, Memory>::iterator it = pending.begin(); it != pending.end(); it++) {
+            ENTRY entry = {it->first, it->second.length()};
+            memcpy(pos, &entry, sizeof(ENTRY));
+            memcpy(pos+sizeof(ENTRY), it->second.operator char *(), it->second.length());
+            pos += sizeof(ENTRY)+it->second.length();
+        }
+        
+        RECORD *header = (RECORD*)record.operator char *();
+        header->magic = WAL_MAGIC;
+        header->count = pending.size()+(reserved_end ? 1 : 0);
+        header->size = size-sizeof(RECORD);
+        header->checksum = checksum(record.operator char *()+sizeof(RECORD), size-sizeof(RECORD));
+        
+        // The only sync of the commit, once the record is durable the batch survives a crash
+        openLog();
+        fseek(fp, log_size, SEEK_SET);
+        size_t written = 0;
+        while (written < size)
+            written += fwrite(record.operator char *()+written, 1, size-written, fp);
+        fflush(fp);
+        fsync(::fileno(fp));
+        log_size += size;
+        
+        if (reserved_end)
+            file.reserve(reserved_end);
+        
+        // Adjacent ranges are applied to the store as one write
+        std::map<unsigned long long, Memory>::iterator it = pending.begin();
+        while (it != pending.end()) {
+            std::map<unsigned long long, Memory>::iterator run_end = it;
+            unsigned long long run_start = it->first;
+            unsigned long long run_stop = it->first+it->second.length();
+            for (run_end++; run_end != pending.end() && run_end->first == run_stop; run_end++)
+                run_stop += run_end->second.length();
+            
+            if (run_stop-run_start == it->second.length()) {
+                file.write(run_start, it->second.operator char *(), it->second.length());
+            } else {
+                Memory run(run_stop-run_start);
+                for (std::map<unsigned long long, Memory>::iterator r = it; r != run_end; r++)
+                    memcpy(run.operator char *()+(r->first-run_start), r->second.operator char *(), r->second.length());
+                file.write(run_start, run.operator char *(), run.length());
+            }
+            
+            it = run_end;
+        }
+        
+        discard();
+        
+        if (log_size >= WAL_CHECKPOINT_SIZE)
+            checkpoint(file);
+    }
+
+    void WriteAheadLog::checkpoint(File &file) {
+        if (!log_size)
+            return;
+        
+        file.sync();
+        
+        if (ftruncate(::fileno(fp), 0) == 0)
+            log_size = 0;
+    }
+
+    void WriteAheadLog::replay(File &file) {
+        FILE *log = fopen(path.operator char *(), "r+");
+        if (!log)
+            return;
+        
+        fp = log;
+        fseek(fp, 0L, SEEK_END);
+        size_t size = ftell(fp);
+        fseek(fp, 0L, SEEK_SET);
+        log_size = size;
+        
+        if (!size)
+            return;
+        
+        Memory log_data(size);
+        size = fread(log_data.operator char *(), 1, size, fp);
+        
+        // Records are applied in commit order, a torn record at the end was never committed
+        size_t pos = 0;
+        while (pos+sizeof(RECORD) <= size) {
+            RECORD header;
+            memcpy(&header, log_data.operator char *()+pos, sizeof(RECORD));
+            
+            char *entries = log_data.operator char *()+pos+sizeof(RECORD);
+            if (header.magic != WAL_MAGIC || header.size > size-pos-sizeof(RECORD) || header.checksum != checksum(entries, header.size))
+                break;
+            
+            char *entry_pos = entries;
+            for (unsigned long long i=0; i<header.count; i++) {
+                ENTRY entry;
+                memcpy(&entry, entry_pos, sizeof(ENTRY));
+                if (entry.length)
+                    file.write(entry.offset, entry_pos+sizeof(ENTRY), entry.length);
+                else
+                    file.reserve(entry.offset);
+                entry_pos += sizeof(ENTRY)+entry.length;
+            }
+            
+            pos += sizeof(RECORD)+header.size;
+        }
+        
+        checkpoint(file);
+    }
+
+    bool WriteAheadLog::isClean() {
+        return log_size == 0;
+    }
+
+    void WriteAheadLog::openLog() {
+        if (fp)
+            return;
+        
+        fp = fopen(path.operator char *(), "r+");
+        if (!fp) {
+            fp = fopen(path.operator char *(), "w+");
+            if (!fp)
+                throw "Failed to open write ahead log";
+        }
+        
+        fseek(fp, 0L, SEEK_END);
+        log_size = ftell(fp);
+    }
+
+    unsigned long long WriteAheadLog::checksum(const char *data, size_t length) {
+        // FNV-1a
+        unsigned long long hash = 0xcbf29ce484222325ULL;
+        for (size_t i=0; i<length; i++) {
+            hash ^= (unsigned char)data[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+}
@@ -0,0 +1,85 @@
+//
+//  WriteAheadLog.h
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#ifndef WriteAheadLog_hpp
+#define WriteAheadLog_hpp
+
+#include <stdio.h>
+
+#include <map>
+#include <vector>
+
+#include <libnrcore/memory/Memory.h>
+#include <libnrcore/memory/String.h>
+#include "File.h"
+
+#define WAL_MAGIC               0x57414C31
+#define WAL_CHECKPOINT_SIZE     (4*1024*1024)
+
+namespace nrcore {
+
+    // Collects the writes of a batch in memory and commits them as a single record appended to
+    // a log next to the store. The log is synced once per commit, the store itself is only synced
+    // when the log is checkpointed, records left in the log are replayed when the store is opened.
+    class WriteAheadLog {
+    public:
+        typedef struct {
+            unsigned long long magic;
+            unsigned long long count;       // Number of entries
+            unsigned long long size;        // Bytes of entries and data following this header
+            unsigned long long checksum;
+        } RECORD;
+        
+        typedef struct {
+            unsigned long long offset;
+            unsigned long long length;      // Followed by length bytes of data, 0 extends the store to offset
+        } ENTRY;
+        
+        WriteAheadLog(const char *store_path);
+        virtual ~WriteAheadLog();
+        
+        void write(unsigned long long offset, const char *data, size_t length);
+        void reserve(unsigned long long end); // Claims the store up to end without writing it
+        void overlay(unsigned long long offset, char *buffer, size_t length);
+        unsigned long long getEnd();
+        bool hasPendingWrites();
+        void discard();
+        
+        // Nested levels of a batch, rolling back a level only drops the writes made since its mark
+        void mark();
+        void releaseMark();
+        void rollbackToMark();
+        
+        void commit(File &file);
+        void checkpoint(File &file);
+        void replay(File &file);
+        bool isClean();
+        
+    private:
+        typedef struct {
+            std::map<unsigned long long, Memory> pending;
+            unsigned long long pending_end;
+            unsigned long long reserved_end;
+        } SAVEPOINT;
+        
+        String path;
+        FILE *fp;
+        unsigned long long log_size;
+        
+        std::map<unsigned long long, Memory> pending; // Non overlapping ranges keyed by store offset
+        unsigned long long pending_end;
+        unsigned long long reserved_end;
+        std::vector<SAVEPOINT> savepoints; // Share the data of pending, which is only replaced while any are held
+        
+        void openLog();
+        static unsigned long long checksum(const char *data, size_t length);
+    };
+
+}
+
+#endif /* WriteAheadLog_hpp */
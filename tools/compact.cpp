@@ -0,0 +1,35 @@
+//
+//  compact.cpp
+//  NrIO
+//
+//  Created by Nyhl Rawlings on 17/10/26.
+//  Copyright © 2026 Liquidsoft Studio. All rights reserved.
+//
+
+#include <stdio.h>
+#include "../libnrio/IndexedDataStore.h"
+
+using namespace nrcore;
+
+static void printProgress(const IndexedDataStore::COMPACT_STATS *stats, void *context) {
+    printf("%llu/%llu files, %llu bytes, %.1f MB/s\n", stats->files, stats->total_files, stats->bytes, stats->bytes_per_second/(1024*1024));
+}
+
+int main(int argc, const char * argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <store>\n", argv[0]);
+        return 1;
+    }
+    
+    try {
+        IndexedDataStore store(argv[1]);
+        IndexedDataStore::COMPACT_STATS stats = store.compact(printProgress);
+        
+        printf("Compacted %s from %llu to %llu bytes in %.2fs\n", argv[1], stats.original_size, stats.compacted_size, stats.elapsed);
+    } catch (const char * e) {
+        fprintf(stderr, "%s\n", e);
+        return 1;
+    }
+    
+    return 0;
+}